@@ -36,9 +36,25 @@ Memory::Memory (Register *r, Number *n)
     return; 
   }
 
+RegisterID Register::getID() const {
+  return ID; 
+}
+
+const Register* Memory::getReg() const {
+  return reg; 
+}
+
+const Number* Memory::getOffset() const {
+  return offset; 
+}
+
+void Memory::rebase(int64_t delta) {
+  offset = new Number(offset->value() + delta); 
+}
+
 std::string Register::emit (const EmitOptions& options) const {
   std::ostringstream s; 
-  std::string reg = options.eightBitRegister ? eightBitReg_assembly_from_register(ID) : options.indirectRegCall ? indirect_call_reg_assembly_from_register(ID) : assembly_from_register(ID); 
+  std::string reg = options.eightBitRegister ? eightBitReg_assembly_from_register(ID) : options.thirtyTwoBitRegister ? thirtyTwoBitReg_assembly_from_register(ID) : options.indirectRegCall ? indirect_call_reg_assembly_from_register(ID) : assembly_from_register(ID); 
   s << reg; 
   return s.str(); 
 }
@@ -239,12 +255,16 @@ const Item* Instruction_cjump::rhs() const { return rhs_; }
 const Label* Instruction_cjump::label() const { return label_; }
 
 const Label* Instruction_label::label() const { return label_; }
+bool Instruction_label::isLoopHeader() const { return loopHeader_; }
+void Instruction_label::markLoopHeader() { loopHeader_ = true; }
 
 const Label* Instruction_goto::label() const { return label_; }
 
 CallType Instruction_call::callType() const { return callType_; }
 const Item* Instruction_call::callee() const { return callee_; }
 const Number* Instruction_call::nArgs() const { return nArgs_; }
+bool Instruction_call::isTail() const { return tail_; }
+void Instruction_call::markTail() { tail_ = true; }
 
 const Register* Instruction_reg_inc_dec::dst() const { return dst_; }
 IncDec Instruction_reg_inc_dec::op() const { return op_; }
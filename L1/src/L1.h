@@ -26,11 +26,15 @@ namespace L1 {
 
   enum CallType {l1, print, input, allocate, tuple_error, tensor_error}; 
 
+  // label_return stores a return label at mem rsp -8 and jumps; call_return uses call/ret 
+  enum CallConvention {label_return, call_return}; 
+
 
   // Items 
 
   struct EmitOptions {
     bool eightBitRegister = false; 
+    bool thirtyTwoBitRegister = false; 
     bool memoryStoredLabel = false; 
     bool functionCall = false; 
     bool indirectRegCall = false; 
@@ -46,6 +50,7 @@ namespace L1 {
     public:
       Register (RegisterID r);
       std::string emit(const EmitOptions& options = EmitOptions{}) const override;
+      RegisterID getID() const; 
 
     private:
       RegisterID ID;
@@ -85,6 +90,10 @@ namespace L1 {
       Memory (Register *r, Number *n); 
       std::string emit(const EmitOptions& options = EmitOptions{}) const override;
 
+      const Register* getReg() const; 
+      const Number* getOffset() const; 
+      void rebase(int64_t delta); 
+
     private: 
       Register *reg; 
       Number *offset; 
@@ -212,8 +221,13 @@ public:
 
   const Label* label() const;
 
+  // The target of a backward jump, aligned so the loop body starts on a fetch boundary
+  bool isLoopHeader() const;
+  void markLoopHeader();
+
 private:
   Label* label_;
+  bool loopHeader_ = false;
 };
 
 
@@ -244,10 +258,15 @@ public:
   const Item* callee() const;
   const Number* nArgs() const;
 
+  // A tail call tears the frame down and jumps, reusing the caller's return address
+  bool isTail() const;
+  void markTail();
+
 private:
   CallType callType_;
   Item* callee_;
   Number* nArgs_;
+  bool tail_ = false;
 };
 
 
@@ -293,6 +312,12 @@ private:
       int64_t locals;
       std::vector<Instruction *> instructions;
 
+      // Leaf frame kept in the red zone below %rsp: no adjustment on entry
+      bool redZone = false;
+
+      // Blocks that only lead to an error call, emitted apart from the hot code
+      std::vector<Instruction *> coldInstructions;
+
       void accept(Behavior& b);
 
   };
@@ -301,6 +326,9 @@ private:
     public:
       std::string entryPointLabel;
       std::vector<Function *> functions;
+
+      // Callee-saved registers the go trampoline preserves for its C caller
+      std::vector<RegisterID> trampolineSaves = {rbx, rbp, r12, r13, r14, r15};
       
       void accept(Behavior& b); 
   };
@@ -8,8 +8,8 @@
 using namespace std;
 
 namespace L1{
-  CodeGenBehavior::CodeGenBehavior(std::ofstream &out)
-    : out (out) {
+  CodeGenBehavior::CodeGenBehavior(std::ofstream &out, CallConvention convention, bool selectEncodings)
+    : out (out), convention (convention), selector (selectEncodings) {
       return; 
     }
  
@@ -17,19 +17,21 @@ namespace L1{
     out << ".text\n";
     out << "  .globl go\n";
     out << "go:\n";
-    out << "  pushq %rbx\n";
-    out << "  pushq %rbp\n";
-    out << "  pushq %r12\n";
-    out << "  pushq %r13\n";
-    out << "  pushq %r14\n";
-    out << "  pushq %r15\n";
+    for (RegisterID r : p.trampolineSaves) {
+      out << "  pushq " << assembly_from_register(r) << "\n";
+    }
+    // An odd number of pushes would shift the stack alignment every function sees
+    bool pad = p.trampolineSaves.size() % 2 != 0; 
+    if (pad) {
+      out << "  subq $8, %rsp\n";
+    }
     out << "  call _" << p.entryPointLabel.substr(1) << "\n";
-    out << "  popq %r15\n";
-    out << "  popq %r14\n";
-    out << "  popq %r13\n";
-    out << "  popq %r12\n";
-    out << "  popq %rbp\n";
-    out << "  popq %rbx\n";
+    if (pad) {
+      out << "  addq $8, %rsp\n";
+    }
+    for (auto r = p.trampolineSaves.rbegin(); r != p.trampolineSaves.rend(); r++) {
+      out << "  popq " << assembly_from_register(*r) << "\n";
+    }
     out << "  retq\n"; 
     for (Function* f: p.functions) {
       f->accept(*this);
@@ -40,19 +42,60 @@ namespace L1{
     out << "_" << f.name.substr(1) << ":" << "\n"; 
     int64_t localsSpace = f.locals * 8; 
     int64_t stackArgsSpace = std::max<int64_t>(0, f.arguments - 6) * 8; 
-    if (localsSpace != 0) {
-      out << "  subq " << "$" << localsSpace << ", " << "%rsp\n";
+    // A real call leaves the stack arguments below the return address for the callee to claim 
+    int64_t entrySpace = convention == call_return ? localsSpace + stackArgsSpace : localsSpace; 
+    if (f.redZone) {
+      entrySpace = 0; 
     }
-    this -> cur_frame_size = localsSpace + stackArgsSpace; 
+    if (entrySpace != 0) {
+      out << "  subq " << "$" << entrySpace << ", " << "%rsp\n";
+    }
+    // ret undoes the entry adjustment plus the stack arguments a jmp-style caller pushed 
+    this -> cur_frame_size = entrySpace + (convention == label_return ? stackArgsSpace : 0); 
     for (Instruction* i: f.instructions) {
       i -> accept(*this); 
     }
+    if (!f.coldInstructions.empty()) {
+      out << "  .section .text.unlikely,\"ax\",@progbits\n"; 
+      out << "_" << f.name.substr(1) << ".cold:\n"; 
+      for (Instruction* i: f.coldInstructions) {
+        i -> accept(*this); 
+      }
+      out << "  .text\n"; 
+    }
+  }
+
+  const EncodingSelector& CodeGenBehavior::encodings() const {
+    return selector; 
+  }
+
+  void CodeGenBehavior::move(const Item* dst, const Item* src) {
+    EmitOptions wide; 
+    wide.memoryStoredLabel = true; 
+    EmitOptions narrow; 
+    narrow.thirtyTwoBitRegister = true; 
+    switch (selector.select_move(dst, src)) {
+      case zero_idiom:
+        out << "  xorl " << dst->emit(narrow) << ", " << dst->emit(narrow) << "\n"; 
+        break; 
+      case zero_extended_move:
+        out << "  movl " << src->emit() << ", " << dst->emit(narrow) << "\n"; 
+        break; 
+      default:
+        out << "  movq " << src->emit(wide) << ", " << dst->emit() << "\n";
+    }
+  }
+
+  void CodeGenBehavior::compare(const Item* left, const Item* right) {
+    if (selector.select_compare(left, right) == zero_test) {
+      out << "  testq " << right->emit() << ", " << right->emit() << "\n"; 
+    } else {
+      out << "  cmpq " << left->emit() << ", " << right->emit() << "\n"; 
+    }
   }
 
   void CodeGenBehavior::act(Instruction_assignment &i) {
-    EmitOptions options; 
-    options.memoryStoredLabel = true; 
-    out << "  movq " << i.src()->emit(options) << ", " << i.dst()->emit() << "\n";
+    move(i.dst(), i.src()); 
   }
 
   void CodeGenBehavior::act(Instruction_aop &i) {
@@ -74,17 +117,16 @@ namespace L1{
     auto *rhs = dynamic_cast<const Number*>(i.rhs()); 
     bool compileTimeCalculate = lhs != nullptr && rhs != nullptr; 
     if (compileTimeCalculate) {
-      out << "  movq " << "$" << comp(lhs->value(), rhs->value(), i.cmp()) << ", " << i.dst()->emit() << "\n"; 
+      Number result(comp(lhs->value(), rhs->value(), i.cmp())); 
+      move(i.dst(), &result); 
       return; 
     }
 
     bool flip = lhs != nullptr && rhs == nullptr; 
-    std::string left = flip ? i.lhs()->emit() : i.rhs() -> emit(); 
-    std::string right = flip ? i.rhs()->emit() : i.lhs()->emit();
+    compare(flip ? i.lhs() : i.rhs(), flip ? i.rhs() : i.lhs()); 
 
     EmitOptions options; 
     options.eightBitRegister = true; 
-    out << "  " << "cmpq " << left << ", " << right << "\n"; 
     out << "  " << assembly_from_cmp(i.cmp(), flip) << " " << i.dst()->emit(options) << "\n"; 
     out << "  " << "movzbq " << i.dst()->emit(options) << ", " << i.dst()->emit() << "\n"; 
   } 
@@ -101,14 +143,14 @@ namespace L1{
     }
 
     bool flip = lhs != nullptr && rhs == nullptr; 
-    std::string left = flip ? i.lhs()->emit() : i.rhs() -> emit(); 
-    std::string right = flip ? i.rhs()->emit() : i.lhs()->emit();
-
-    out << "  " << "cmpq " << left << ", " << right << "\n"; 
+    compare(flip ? i.lhs() : i.rhs(), flip ? i.rhs() : i.lhs()); 
     out << "  " << jump_assembly_from_cmp(i.cmp(), flip) << " " << i.label()->emit() << "\n";
   } 
 
   void CodeGenBehavior::act(Instruction_label &i) {
+    if (i.isLoopHeader()) {
+      out << "  .p2align 4,,10\n"; 
+    }
     out << "  " << i.label()->emit() << ":\n"; 
   } 
 
@@ -124,7 +166,20 @@ namespace L1{
   } 
 
   void CodeGenBehavior::act(Instruction_call &i) {
-    if (i.callType() == l1) {
+    if (i.callType() == l1 && i.isTail()) {
+      if (cur_frame_size != 0) {
+        out << "  addq " << "$" << cur_frame_size << ", " << "%rsp\n"; 
+      }
+      EmitOptions options; 
+      options.functionCall = true;
+      options.indirectRegCall = true; 
+      out << "  jmp " << i.callee()->emit(options) << "\n"; 
+    } else if (i.callType() == l1 && convention == call_return) {
+      EmitOptions options; 
+      options.functionCall = true;
+      options.indirectRegCall = true; 
+      out << "  call " << i.callee()->emit(options) << "\n"; 
+    } else if (i.callType() == l1) {
       int64_t space = i.nArgs()->value() >= 6 ? (i.nArgs()->value() - 6) * 8 + 8 : 8; 
       if (space != 0) {
         out << "  subq " << "$" << space << ", " << "%rsp\n";
@@ -161,16 +216,19 @@ namespace L1{
   } 
 
 
-  void generate_code(Program p){
+  void generate_code(Program p, CallConvention convention, bool selectEncodings, bool verbose){
 
     std::ofstream outputFile;
     outputFile.open("prog.S");
 
     // codegen
-    CodeGenBehavior b(outputFile);
+    CodeGenBehavior b(outputFile, convention, selectEncodings);
     p.accept(b); 
 
     outputFile.close();
+    if (verbose) {
+      b.encodings().report(std::cerr); 
+    }
    
     return ;
   }
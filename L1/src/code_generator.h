@@ -1,6 +1,7 @@
 #pragma once
 
 #include <L1.h>
+#include <encoding_selection.h>
 
 // Base visitor class with all the visit declarations 
 // Then concrete visitor class with all the visit definitions (like CodeGenVisitor ex)
@@ -41,7 +42,7 @@ namespace L1{
 
   class CodeGenBehavior : public Behavior {
     public:
-      explicit CodeGenBehavior(std::ofstream &out);
+      CodeGenBehavior(std::ofstream &out, CallConvention convention, bool selectEncodings);
       void act(Program &p) override; 
       void act(Function &f) override; 
       void act(Instruction_assignment &i) override; 
@@ -57,11 +58,18 @@ namespace L1{
       virtual void act(Instruction_reg_inc_dec &i) override; 
       virtual void act(Instruction_lea &i) override; 
 
+      const EncodingSelector& encodings() const; 
+
     private:
+      void move(const Item* dst, const Item* src); 
+      void compare(const Item* left, const Item* right); 
+
       int64_t cur_frame_size; 
       std::ofstream &out; 
+      CallConvention convention; 
+      EncodingSelector selector; 
   };
 
-  void generate_code(Program p);
+  void generate_code(Program p, CallConvention convention = label_return, bool selectEncodings = false, bool verbose = false);
 
 }
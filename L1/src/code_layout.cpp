@@ -0,0 +1,96 @@
+#include <unordered_map>
+
+#include <code_layout.h>
+
+namespace L1 {
+
+  static bool is_error_call(const Instruction* i) {
+    auto *call = dynamic_cast<const Instruction_call*>(i);
+    return call != nullptr && (call->callType() == tuple_error || call->callType() == tensor_error);
+  }
+
+  // Control never reaches the next instruction from here
+  static bool ends_flow(const Instruction* i) {
+    if (auto *call = dynamic_cast<const Instruction_call*>(i)) {
+      return is_error_call(i) || call->isTail();
+    }
+    return dynamic_cast<const Instruction_goto*>(i) || dynamic_cast<const Instruction_ret*>(i);
+  }
+
+  // Runtime calls return to the next instruction; L1 calls carry a return label
+  static bool is_straight_line(const Instruction* i) {
+    if (auto *call = dynamic_cast<const Instruction_call*>(i)) {
+      return call->callType() != l1 && !is_error_call(i);
+    }
+    return !dynamic_cast<const Instruction_label*>(i) && !dynamic_cast<const Instruction_goto*>(i)
+        && !dynamic_cast<const Instruction_cjump*>(i) && !dynamic_cast<const Instruction_ret*>(i);
+  }
+
+  static bool is_label(const Instruction* i, const std::string& name) {
+    auto *label = dynamic_cast<const Instruction_label*>(i);
+    return label != nullptr && label->label()->emit() == name;
+  }
+
+  /*
+   * :err ... call tensor-error N is cold when nothing but straight-line code sits
+   * between the label and the call. Whatever fell through into it now jumps
+   * there: "cjump a < b :ok; <cold>; :ok" becomes "cjump b <= a :err; :ok", and
+   * anything else gets a goto. The entry block stays put: the prologue falls
+   * into it and there is nothing ahead of it to carry the jump.
+   */
+  static void split_cold_blocks(Function& f) {
+    auto& instructions = f.instructions;
+    std::vector<Instruction*> hot;
+    size_t j = 0;
+    while (j < instructions.size()) {
+      auto *label = dynamic_cast<Instruction_label*>(instructions[j]);
+      size_t end = j + 1;
+      while (label != nullptr && end < instructions.size() && is_straight_line(instructions[end])) end++;
+      if (label == nullptr || j == 0 || end == instructions.size() || !is_error_call(instructions[end])) {
+        hot.push_back(instructions[j++]);
+        continue;
+      }
+
+      Label* cold = const_cast<Label*>(label->label());
+      if (!ends_flow(hot.back())) {
+        auto *cj = dynamic_cast<Instruction_cjump*>(hot.back());
+        bool invertible = cj != nullptr && cj->cmp() != equal && end + 1 < instructions.size()
+                       && is_label(instructions[end + 1], cj->label()->emit());
+        if (invertible) {
+          CMP negated = cj->cmp() == less_than ? less_than_equal : less_than;
+          hot.back() = new Instruction_cjump(const_cast<Item*>(cj->rhs()), negated, const_cast<Item*>(cj->lhs()), cold);
+          delete cj;
+        } else {
+          hot.push_back(new Instruction_goto(cold));
+        }
+      }
+      f.coldInstructions.insert(f.coldInstructions.end(), instructions.begin() + j, instructions.begin() + end + 1);
+      j = end + 1;
+    }
+    instructions = hot;
+  }
+
+  static void mark_loop_headers(Function& f) {
+    std::unordered_map<std::string, Instruction_label*> seen;
+    for (Instruction* i : f.instructions) {
+      const Label* target = nullptr;
+      if (auto *label = dynamic_cast<Instruction_label*>(i)) {
+        seen[label->label()->emit()] = label;
+      } else if (auto *g = dynamic_cast<const Instruction_goto*>(i)) {
+        target = g->label();
+      } else if (auto *c = dynamic_cast<const Instruction_cjump*>(i)) {
+        target = c->label();
+      }
+      if (target == nullptr) continue;
+      auto it = seen.find(target->emit());
+      if (it != seen.end()) it->second->markLoopHeader();
+    }
+  }
+
+  void layout_code(Program& p) {
+    for (Function* f : p.functions) {
+      split_cold_blocks(*f);
+      mark_loop_headers(*f);
+    }
+  }
+}
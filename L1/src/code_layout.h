@@ -0,0 +1,14 @@
+#pragma once
+
+#include <L1.h>
+
+namespace L1 {
+
+  /*
+   * Moves every block that can only end in a tuple or tensor error call out of
+   * the function body and into coldInstructions, which the backends place in
+   * .text.unlikely, then marks the targets of backward jumps as loop headers.
+   */
+  void layout_code(Program& p);
+
+}
@@ -15,10 +15,15 @@
 
 #include <parser.h>
 #include <code_generator.h>
+#include <object_generator.h>
+#include <helper.h>
+#include <peephole.h>
+#include <frame_analysis.h>
+#include <code_layout.h>
 
 
 void print_help (char *progName){
-  std::cerr << "Usage: " << progName << " [-v] [-g 0|1] [-O 0|1|2] SOURCE" << std::endl;
+  std::cerr << "Usage: " << progName << " [-v] [-g 0|1] [-O 0|1|2] [-c jmp|call] [-f asm|elf] SOURCE" << std::endl;
   return ;
 }
 
@@ -27,8 +32,10 @@ int main(
   char **argv
   ){
   auto enable_code_generator = false;
-  int32_t optLevel = 0;
-  bool verbose;
+  int32_t optLevel = 1;
+  bool verbose = false;
+  L1::CallConvention convention = L1::label_return;
+  bool elfObject = false;
 
   /* 
    * Check the compiler arguments.
@@ -38,7 +45,7 @@ int main(
     return 1;
   }
   int32_t opt;
-  while ((opt = getopt(argc, argv, "vg:O:")) != -1) {
+  while ((opt = getopt(argc, argv, "vg:O:c:f:")) != -1) {
     switch (opt){
       case 'O':
         optLevel = strtoul(optarg, NULL, 0);
@@ -48,6 +55,14 @@ int main(
         enable_code_generator = (strtoul(optarg, NULL, 0) == 0) ? false : true ;
         break ;
 
+      case 'c':
+        convention = L1::convention_from_string(optarg);
+        break ;
+
+      case 'f':
+        elfObject = std::string(optarg) == "elf";
+        break ;
+
       case 'v':
         verbose = true;
         break ;
@@ -67,7 +82,16 @@ int main(
    * Generate x86_64 assembly.
    */
   if (enable_code_generator){
-    L1::generate_code(p);
+    if (optLevel > 0) {
+      L1::optimize_peephole(p, verbose);
+      L1::analyze_frames(p, convention);
+      L1::layout_code(p);
+    }
+    if (elfObject) {
+      L1::generate_object(p, convention, optLevel > 0, verbose);
+    } else {
+      L1::generate_code(p, convention, optLevel > 0, verbose);
+    }
   }
 
 
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <elf.h>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <elf_writer.h>
+
+namespace L1 {
+
+  namespace {
+    enum Section { null_section, text_section, rela_section, cold_section, rela_cold_section, symtab_section, strtab_section, shstrtab_section, note_section, section_count };
+
+    // Each text section is followed by its relocations
+    Section section_of(TextSection s) {
+      return s == hot_text ? text_section : cold_section;
+    }
+
+    struct StringTable {
+      std::string data = std::string(1, '\0');
+
+      uint32_t add(const std::string& s) {
+        uint32_t at = data.size();
+        data += s;
+        data += '\0';
+        return at;
+      }
+    };
+
+    void pad(std::string& out, size_t align) {
+      while (out.size() % align) out += '\0';
+    }
+
+    template <class T>
+    void append(std::string& out, const T& value) {
+      out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+  }
+
+  /*
+   * Layout: header, .text, .rela.text, .text.unlikely, .rela.text.unlikely,
+   * .symtab, .strtab, .shstrtab, then the section header table. Local symbols
+   * come first as the ELF spec requires; symbols 1 and 2 are the section
+   * symbols that relocations against labels use.
+   */
+  void write_elf_object(const std::string& path, const TextSections& text,
+                        const std::vector<ObjectSymbol>& symbols,
+                        const std::vector<ObjectRelocation>& relocations) {
+    StringTable strtab;
+    std::vector<Elf64_Sym> symtab(1 + text_section_count, Elf64_Sym{});
+    for (int t = hot_text; t < text_section_count; t++) {
+      symtab[1 + t].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+      symtab[1 + t].st_shndx = section_of((TextSection)t);
+    }
+
+    std::unordered_map<std::string, uint32_t> symbolIndex;
+    size_t firstGlobal = 0;
+    for (int pass = 0; pass < 2; pass++) {
+      if (pass == 1) firstGlobal = symtab.size();
+      for (const auto& s : symbols) {
+        if (s.global != (pass == 1)) continue;
+        Elf64_Sym sym{};
+        sym.st_name = strtab.add(s.name);
+        sym.st_info = ELF64_ST_INFO(s.global ? STB_GLOBAL : STB_LOCAL, s.defined ? STT_FUNC : STT_NOTYPE);
+        sym.st_shndx = s.defined ? section_of(s.section) : SHN_UNDEF;
+        sym.st_value = s.value;
+        symbolIndex[s.name] = symtab.size();
+        symtab.push_back(sym);
+      }
+    }
+
+    std::vector<Elf64_Rela> rela[text_section_count];
+    for (const auto& r : relocations) {
+      uint32_t sym = 1 + r.target;
+      if (!r.symbol.empty()) {
+        auto it = symbolIndex.find(r.symbol);
+        if (it == symbolIndex.end()) throw std::runtime_error("relocation against unknown symbol " + r.symbol);
+        sym = it->second;
+      }
+      Elf64_Rela entry{};
+      entry.r_offset = r.offset;
+      entry.r_info = ELF64_R_INFO(sym, r.type);
+      entry.r_addend = r.addend;
+      rela[r.section].push_back(entry);
+    }
+
+    StringTable shstrtab;
+    std::vector<Elf64_Shdr> headers(section_count, Elf64_Shdr{});
+    const char* names[section_count] = {"", ".text", ".rela.text", ".text.unlikely", ".rela.text.unlikely", ".symtab", ".strtab", ".shstrtab", ".note.GNU-stack"};
+    for (int s = text_section; s < section_count; s++) {
+      headers[s].sh_name = shstrtab.add(names[s]);
+    }
+    std::string out(sizeof(Elf64_Ehdr), '\0');
+
+    auto place = [&](Section s, uint32_t type, size_t align, const void* data, size_t size) {
+      pad(out, align);
+      headers[s].sh_type = type;
+      headers[s].sh_addralign = align;
+      headers[s].sh_offset = out.size();
+      headers[s].sh_size = size;
+      out.append(reinterpret_cast<const char*>(data), size);
+    };
+    for (int t = hot_text; t < text_section_count; t++) {
+      Section code = section_of((TextSection)t);
+      Section relocs = (Section)(code + 1);
+      place(code, SHT_PROGBITS, t == hot_text ? 16 : 1, text[t].data(), text[t].size());
+      headers[code].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+
+      place(relocs, SHT_RELA, 8, rela[t].data(), rela[t].size() * sizeof(Elf64_Rela));
+      headers[relocs].sh_flags = SHF_INFO_LINK;
+      headers[relocs].sh_link = symtab_section;
+      headers[relocs].sh_info = code;
+      headers[relocs].sh_entsize = sizeof(Elf64_Rela);
+    }
+
+    place(symtab_section, SHT_SYMTAB, 8, symtab.data(), symtab.size() * sizeof(Elf64_Sym));
+    headers[symtab_section].sh_link = strtab_section;
+    headers[symtab_section].sh_info = firstGlobal;
+    headers[symtab_section].sh_entsize = sizeof(Elf64_Sym);
+
+    place(strtab_section, SHT_STRTAB, 1, strtab.data.data(), strtab.data.size());
+
+    // An empty .note.GNU-stack keeps the stack non-executable, as the assembler would
+    headers[note_section].sh_type = SHT_PROGBITS;
+    headers[note_section].sh_addralign = 1;
+    headers[note_section].sh_offset = out.size();
+
+    place(shstrtab_section, SHT_STRTAB, 1, shstrtab.data.data(), shstrtab.data.size());
+
+    pad(out, 8);
+    Elf64_Ehdr header{};
+    std::copy(ELFMAG, ELFMAG + SELFMAG, header.e_ident);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = out.size();
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = section_count;
+    header.e_shstrndx = shstrtab_section;
+    for (const auto& h : headers) append(out, h);
+    out.replace(0, sizeof(Elf64_Ehdr), reinterpret_cast<const char*>(&header), sizeof(Elf64_Ehdr));
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(out.data(), out.size());
+  }
+}
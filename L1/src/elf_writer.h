@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace L1 {
+
+  // .text and .text.unlikely, where cold error paths go
+  enum TextSection {hot_text, cold_text, text_section_count};
+
+  using TextSections = std::array<std::vector<uint8_t>, text_section_count>;
+
+  struct ObjectSymbol {
+    std::string name;
+    TextSection section;
+    uint64_t value;
+    bool global;
+    bool defined;
+  };
+
+  // symbol == "" means "relative to the start of target"
+  struct ObjectRelocation {
+    TextSection section;
+    uint64_t offset;
+    std::string symbol;
+    TextSection target;
+    uint32_t type;
+    int64_t addend;
+  };
+
+  /*
+   * Writes a relocatable x86-64 ELF object holding .text and .text.unlikely.
+   * Defined symbols are functions in either section; undefined ones are left
+   * for the linker.
+   */
+  void write_elf_object(const std::string& path, const TextSections& text,
+                        const std::vector<ObjectSymbol>& symbols,
+                        const std::vector<ObjectRelocation>& relocations);
+
+}
@@ -0,0 +1,61 @@
+#include <encoding_selection.h>
+#include <x86_encoder.h>
+
+namespace L1 {
+
+  namespace {
+    const char* choice_names[encoding_choice_count] = {"default", "xorl-zero", "movl-immediate", "testq-zero"};
+  }
+
+  EncodingSelector::EncodingSelector(bool enabled)
+    : enabled (enabled) {
+      return;
+    }
+
+  EncodingChoice EncodingSelector::select_move(const Item* dst, const Item* src) {
+    auto *r = dynamic_cast<const Register*>(dst);
+    auto *n = dynamic_cast<const Number*>(src);
+    if (!enabled || r == nullptr || n == nullptr || n->value() < 0 || n->value() > UINT32_MAX) {
+      return default_encoding;
+    }
+
+    X86Encoder longer, shorter;
+    longer.mov(dst, src);
+    EncodingChoice choice = n->value() == 0 ? zero_idiom : zero_extended_move;
+    if (choice == zero_idiom) {
+      shorter.zero32(r);
+    } else {
+      shorter.mov32(r, n->value());
+    }
+    record(choice, longer.offset(), shorter.offset());
+    return choice;
+  }
+
+  EncodingChoice EncodingSelector::select_compare(const Item* left, const Item* right) {
+    auto *n = dynamic_cast<const Number*>(left);
+    auto *r = dynamic_cast<const Register*>(right);
+    if (!enabled || n == nullptr || r == nullptr || n->value() != 0) {
+      return default_encoding;
+    }
+
+    X86Encoder longer, shorter;
+    longer.cmp(left, right);
+    shorter.test(r);
+    record(zero_test, longer.offset(), shorter.offset());
+    return zero_test;
+  }
+
+  void EncodingSelector::record(EncodingChoice choice, size_t longer, size_t shorter) {
+    hits[choice]++;
+    bytesSaved[choice] += longer - shorter;
+  }
+
+  void EncodingSelector::report(std::ostream& out) const {
+    size_t total = 0;
+    for (int c = zero_idiom; c < encoding_choice_count; c++) {
+      out << "encoding " << choice_names[c] << ": " << hits[c] << " hits, " << bytesSaved[c] << " bytes saved\n";
+      total += bytesSaved[c];
+    }
+    out << "encoding total: " << total << " bytes saved\n";
+  }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <iostream>
+
+#include <L1.h>
+
+namespace L1 {
+
+  enum EncodingChoice {default_encoding, zero_idiom, zero_extended_move, zero_test, encoding_choice_count};
+
+  /*
+   * Picks a shorter but equivalent encoding where the operands allow it:
+   * xorl r32, r32 for a register set to 0, movl $imm, r32 for constants that
+   * fit in 32 unsigned bits (the write zero-extends), and testq r, r for
+   * compares against 0. Both backends ask the same questions, so the text and
+   * object outputs pick equivalent encodings; the bytes still differ where as
+   * relaxes branches to rel8 or uses short accumulator forms. The xor clobbers
+   * flags, which is fine because L1 never keeps flags live across an assignment.
+   */
+  class EncodingSelector {
+    public:
+      explicit EncodingSelector(bool enabled);
+      EncodingChoice select_move(const Item* dst, const Item* src);
+
+      // Operands in AT&T order, as passed to cmpq
+      EncodingChoice select_compare(const Item* left, const Item* right);
+
+      void report(std::ostream& out) const;
+
+    private:
+      void record(EncodingChoice choice, size_t longer, size_t shorter);
+
+      bool enabled;
+      size_t hits[encoding_choice_count] = {};
+      size_t bytesSaved[encoding_choice_count] = {};
+  };
+
+}
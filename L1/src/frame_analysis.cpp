@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include <frame_analysis.h>
+
+namespace L1 {
+
+  static std::vector<const Item*> operands(const Instruction* i) {
+    if (auto *a = dynamic_cast<const Instruction_assignment*>(i)) return {a->dst(), a->src()};
+    if (auto *a = dynamic_cast<const Instruction_aop*>(i)) return {a->dst(), a->rhs()};
+    if (auto *s = dynamic_cast<const Instruction_sop*>(i)) return {s->dst(), s->src()};
+    if (auto *m = dynamic_cast<const Instruction_mem_aop*>(i)) return {m->lhs(), m->rhs()};
+    if (auto *c = dynamic_cast<const Instruction_cmp_assignment*>(i)) return {c->dst(), c->lhs(), c->rhs()};
+    if (auto *c = dynamic_cast<const Instruction_cjump*>(i)) return {c->lhs(), c->rhs()};
+    if (auto *d = dynamic_cast<const Instruction_reg_inc_dec*>(i)) return {d->dst()};
+    if (auto *l = dynamic_cast<const Instruction_lea*>(i)) return {l->dst(), l->lhs(), l->rhs()};
+    return {};
+  }
+
+  // The register an instruction overwrites, if any
+  static const Register* written(const Instruction* i) {
+    if (auto *a = dynamic_cast<const Instruction_assignment*>(i)) return dynamic_cast<const Register*>(a->dst());
+    if (auto *a = dynamic_cast<const Instruction_aop*>(i)) return a->dst();
+    if (auto *s = dynamic_cast<const Instruction_sop*>(i)) return s->dst();
+    if (auto *m = dynamic_cast<const Instruction_mem_aop*>(i)) return dynamic_cast<const Register*>(m->lhs());
+    if (auto *c = dynamic_cast<const Instruction_cmp_assignment*>(i)) return c->dst();
+    if (auto *d = dynamic_cast<const Instruction_reg_inc_dec*>(i)) return d->dst();
+    if (auto *l = dynamic_cast<const Instruction_lea*>(i)) return l->dst();
+    return nullptr;
+  }
+
+  static bool is_return_address_store(const Instruction* i, const std::string& label) {
+    auto *a = dynamic_cast<const Instruction_assignment*>(i);
+    if (a == nullptr || dynamic_cast<const Label*>(a->src()) == nullptr || a->src()->emit() != label) return false;
+    auto *m = dynamic_cast<const Memory*>(a->dst());
+    return m != nullptr && m->getReg()->getID() == rsp && m->getOffset()->value() == -8;
+  }
+
+  /*
+   * call @f N; [:ret;] return  =>  tail call @f N
+   * Only register-argument callees qualify: their frame starts right at our return
+   * address once ours is popped. Under label_return the return label must have no
+   * other use than the store of it in front of the call, and both go away.
+   */
+  static void lower_tail_calls(Function& f) {
+    auto& instructions = f.instructions;
+    std::unordered_map<std::string, size_t> references;
+    for (const Instruction* i : instructions) {
+      if (auto *a = dynamic_cast<const Instruction_assignment*>(i)) {
+        if (dynamic_cast<const Label*>(a->src())) references[a->src()->emit()]++;
+      } else if (auto *g = dynamic_cast<const Instruction_goto*>(i)) {
+        references[g->label()->emit()]++;
+      } else if (auto *c = dynamic_cast<const Instruction_cjump*>(i)) {
+        references[c->label()->emit()]++;
+      }
+    }
+
+    std::vector<char> dropped(instructions.size(), 0);
+    for (size_t j = 0; j + 1 < instructions.size(); j++) {
+      auto *call = dynamic_cast<Instruction_call*>(instructions[j]);
+      if (call == nullptr || call->callType() != l1 || call->nArgs()->value() > 6) continue;
+      size_t k = j + 1;
+      auto *label = dynamic_cast<const Instruction_label*>(instructions[k]);
+      size_t store = j;
+      if (label != nullptr) {
+        std::string ret = label->label()->emit();
+        if (references[ret] != 1) continue;
+        // Only argument setup sits between the store and the call
+        bool found = false;
+        while (store > 0 && !found) {
+          store--;
+          found = is_return_address_store(instructions[store], ret);
+          if (!found && !dynamic_cast<const Instruction_assignment*>(instructions[store])) break;
+        }
+        if (!found) continue;
+        k++;
+      }
+      if (k >= instructions.size() || !dynamic_cast<const Instruction_ret*>(instructions[k])) continue;
+      call->markTail();
+      if (label != nullptr) {
+        dropped[store] = dropped[j + 1] = 1;
+      }
+      dropped[k] = 1;
+    }
+
+    size_t kept = 0;
+    for (size_t j = 0; j < instructions.size(); j++) {
+      if (dropped[j]) {
+        delete instructions[j];
+      } else {
+        instructions[kept++] = instructions[j];
+      }
+    }
+    instructions.resize(kept);
+  }
+
+  /*
+   * A function qualifies when it never calls and %rsp only ever appears as a memory
+   * base, so nothing can push below it and rebasing every access is enough. Under
+   * call_return the stack arguments already sit below %rsp on entry and move too.
+   */
+  static void use_red_zone(Function& f, CallConvention convention) {
+    int64_t stackArgsSpace = std::max<int64_t>(0, f.arguments - 6) * 8;
+    int64_t frame = f.locals * 8 + (convention == call_return ? stackArgsSpace : 0);
+    if (frame == 0 || frame > redZoneBytes) return;
+    for (const Instruction* i : f.instructions) {
+      if (dynamic_cast<const Instruction_call*>(i)) return;
+      for (const Item* item : operands(i)) {
+        auto *r = dynamic_cast<const Register*>(item);
+        if (r != nullptr && r->getID() == rsp) return;
+      }
+    }
+    for (const Instruction* i : f.instructions) {
+      for (const Item* item : operands(i)) {
+        auto *m = dynamic_cast<const Memory*>(item);
+        if (m != nullptr && m->getReg()->getID() == rsp) {
+          const_cast<Memory*>(m)->rebase(-frame);
+        }
+      }
+    }
+    f.redZone = true;
+  }
+
+  void analyze_frames(Program& p, CallConvention convention) {
+    std::vector<RegisterID> saves;
+    for (Function* f : p.functions) {
+      lower_tail_calls(*f);
+      use_red_zone(*f, convention);
+      for (const Instruction* i : f->instructions) {
+        const Register* r = written(i);
+        if (r == nullptr) continue;
+        bool calleeSaved = std::find(p.trampolineSaves.begin(), p.trampolineSaves.end(), r->getID()) != p.trampolineSaves.end();
+        if (calleeSaved && std::find(saves.begin(), saves.end(), r->getID()) == saves.end()) {
+          saves.push_back(r->getID());
+        }
+      }
+    }
+    // Keep the push order fixed so the pops mirror it
+    std::vector<RegisterID> ordered;
+    for (RegisterID r : p.trampolineSaves) {
+      if (std::find(saves.begin(), saves.end(), r) != saves.end()) ordered.push_back(r);
+    }
+    p.trampolineSaves = ordered;
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <L1.h>
+
+namespace L1 {
+
+  // Bytes below %rsp the System V ABI keeps safe from signal handlers
+  inline const int64_t redZoneBytes = 128;
+
+  /*
+   * Turns calls that are immediately returned from into tail calls, moves the frames
+   * of small leaf functions into the red zone, and trims the go trampoline down to
+   * the callee-saved registers some function actually writes.
+   */
+  void analyze_frames(Program& p, CallConvention convention);
+
+}
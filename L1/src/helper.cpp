@@ -125,6 +125,31 @@ namespace L1 {
     }
   }
 
+  std::string thirtyTwoBitReg_assembly_from_register(RegisterID ID) {
+    switch (ID) {
+      case rax: return "%eax";
+      case rbx: return "%ebx";
+      case rcx: return "%ecx";
+      case rdx: return "%edx";
+
+      case rdi: return "%edi";
+      case rsi: return "%esi";
+      case rbp: return "%ebp";
+      case rsp: return "%esp";
+
+      case r8:  return "%r8d";
+      case r9:  return "%r9d";
+      case r10: return "%r10d";
+      case r11: return "%r11d";
+      case r12: return "%r12d";
+      case r13: return "%r13d";
+      case r14: return "%r14d";
+      case r15: return "%r15d";
+    }
+
+  return "";
+  }
+
   std::string eightBitReg_assembly_from_register(RegisterID ID) {
     switch (ID) {
       case rax: return "%al";
@@ -184,4 +209,10 @@ namespace L1 {
     return 0; 
   }
 
+  CallConvention convention_from_string(std::string_view s) {
+    return s == "jmp" ? CallConvention::label_return:
+           s == "call" ? CallConvention::call_return:
+           throw std::runtime_error("bad calling convention");
+  }
+
 }
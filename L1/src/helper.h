@@ -20,9 +20,12 @@ namespace L1 {
     std::string assembly_from_sop(SOP op); 
     std::string assembly_from_register(RegisterID id); 
     std::string eightBitReg_assembly_from_register(RegisterID ID);
+    std::string thirtyTwoBitReg_assembly_from_register(RegisterID ID);
     std::string indirect_call_reg_assembly_from_register(RegisterID id);
     std::string assembly_from_cmp(CMP cmp, bool flip);
     std::string jump_assembly_from_cmp(CMP cmp, bool flip); 
 
     int comp(int64_t lhs, int64_t rhs, CMP op); 
+
+    CallConvention convention_from_string(std::string_view s); 
 }
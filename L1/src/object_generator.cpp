@@ -0,0 +1,241 @@
+#include <elf.h>
+#include <set>
+
+#include <object_generator.h>
+#include <elf_writer.h>
+#include <helper.h>
+
+namespace L1{
+  ObjectCodeGenBehavior::ObjectCodeGenBehavior(CallConvention convention, bool selectEncodings)
+    : convention (convention), selector (selectEncodings) {
+      return;
+    }
+
+  void ObjectCodeGenBehavior::act(Program &p) {
+    encoder.define_label("go");
+    for (RegisterID r : p.trampolineSaves) {
+      encoder.push(r);
+    }
+    bool pad = p.trampolineSaves.size() % 2 != 0;
+    if (pad) {
+      encoder.adjust_rsp(-8);
+    }
+    encoder.call("_" + p.entryPointLabel.substr(1));
+    if (pad) {
+      encoder.adjust_rsp(8);
+    }
+    for (auto r = p.trampolineSaves.rbegin(); r != p.trampolineSaves.rend(); r++) {
+      encoder.pop(*r);
+    }
+    encoder.ret();
+    for (Function* f: p.functions) {
+      f->accept(*this);
+    }
+    encoder.finish();
+  }
+
+  void ObjectCodeGenBehavior::act(Function& f) {
+    std::string name = "_" + f.name.substr(1);
+    functionSymbols.push_back({name, hot_text, encoder.offset()});
+    encoder.define_label(name);
+    int64_t localsSpace = f.locals * 8;
+    int64_t stackArgsSpace = std::max<int64_t>(0, f.arguments - 6) * 8;
+    int64_t entrySpace = convention == call_return ? localsSpace + stackArgsSpace : localsSpace;
+    if (f.redZone) {
+      entrySpace = 0;
+    }
+    encoder.adjust_rsp(-entrySpace);
+    this -> cur_frame_size = entrySpace + (convention == label_return ? stackArgsSpace : 0);
+    for (Instruction* i: f.instructions) {
+      i -> accept(*this);
+    }
+    if (!f.coldInstructions.empty()) {
+      encoder.switch_section(cold_text);
+      functionSymbols.push_back({name + ".cold", cold_text, encoder.offset()});
+      for (Instruction* i: f.coldInstructions) {
+        i -> accept(*this);
+      }
+      encoder.switch_section(hot_text);
+    }
+  }
+
+  const EncodingSelector& ObjectCodeGenBehavior::encodings() const {
+    return selector;
+  }
+
+  void ObjectCodeGenBehavior::move(const Item* dst, const Item* src) {
+    switch (selector.select_move(dst, src)) {
+      case zero_idiom:
+        encoder.zero32(dynamic_cast<const Register*>(dst));
+        break;
+      case zero_extended_move:
+        encoder.mov32(dynamic_cast<const Register*>(dst), dynamic_cast<const Number*>(src)->value());
+        break;
+      default:
+        encoder.mov(dst, src);
+    }
+  }
+
+  void ObjectCodeGenBehavior::compare(const Item* left, const Item* right) {
+    if (selector.select_compare(left, right) == zero_test) {
+      encoder.test(dynamic_cast<const Register*>(right));
+    } else {
+      encoder.cmp(left, right);
+    }
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_assignment &i) {
+    move(i.dst(), i.src());
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_aop &i) {
+    encoder.aop(i.aop(), i.dst(), i.rhs());
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_sop &i) {
+    encoder.shift(i.sop(), i.dst(), i.src());
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_mem_aop &i) {
+    encoder.aop(i.aop(), i.lhs(), i.rhs());
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_cmp_assignment &i) {
+    auto *lhs = dynamic_cast<const Number*>(i.lhs());
+    auto *rhs = dynamic_cast<const Number*>(i.rhs());
+    if (lhs != nullptr && rhs != nullptr) {
+      Number result(comp(lhs->value(), rhs->value(), i.cmp()));
+      move(i.dst(), &result);
+      return;
+    }
+
+    bool flip = lhs != nullptr && rhs == nullptr;
+    compare(flip ? i.lhs() : i.rhs(), flip ? i.rhs() : i.lhs());
+    encoder.setcc(i.cmp(), flip, i.dst());
+    encoder.movzx8(i.dst());
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_cjump &i) {
+    auto *lhs = dynamic_cast<const Number*>(i.lhs());
+    auto *rhs = dynamic_cast<const Number*>(i.rhs());
+    if (lhs != nullptr && rhs != nullptr) {
+      if (comp(lhs->value(), rhs->value(), i.cmp())) {
+        encoder.jmp(i.label()->emit());
+      }
+      return;
+    }
+
+    bool flip = lhs != nullptr && rhs == nullptr;
+    compare(flip ? i.lhs() : i.rhs(), flip ? i.rhs() : i.lhs());
+    encoder.jcc(i.cmp(), flip, i.label()->emit());
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_label &i) {
+    if (i.isLoopHeader()) {
+      encoder.align(4, 10);
+    }
+    encoder.define_label(i.label()->emit());
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_goto &i) {
+    encoder.jmp(i.label()->emit());
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_ret &i) {
+    encoder.adjust_rsp(cur_frame_size);
+    encoder.ret();
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_call &i) {
+    if (i.callType() == l1 && i.isTail()) {
+      EmitOptions options;
+      options.functionCall = true;
+      encoder.adjust_rsp(cur_frame_size);
+      auto *target = dynamic_cast<const Register*>(i.callee());
+      if (target != nullptr) {
+        encoder.jmp(target);
+      } else {
+        encoder.jmp(i.callee()->emit(options));
+      }
+    } else if (i.callType() == l1) {
+      if (convention == label_return) {
+        int64_t space = i.nArgs()->value() >= 6 ? (i.nArgs()->value() - 6) * 8 + 8 : 8;
+        encoder.adjust_rsp(-space);
+      }
+      EmitOptions options;
+      options.functionCall = true;
+      auto *target = dynamic_cast<const Register*>(i.callee());
+      if (convention == call_return && target != nullptr) {
+        encoder.call(target);
+      } else if (convention == call_return) {
+        encoder.call(i.callee()->emit(options));
+      } else if (target != nullptr) {
+        encoder.jmp(target);
+      } else {
+        encoder.jmp(i.callee()->emit(options));
+      }
+    } else if (i.callType() == print) {
+      encoder.call_external("print");
+    } else if (i.callType() == allocate) {
+      encoder.call_external("allocate");
+    } else if (i.callType() == input) {
+      encoder.call_external("input");
+    } else if (i.callType() == tuple_error) {
+      encoder.call_external("tuple_error");
+    } else if (i.callType() == tensor_error) {
+      if (i.nArgs()->value() == 1) {
+        encoder.call_external("array_tensor_error_null");
+      } else if (i.nArgs()->value() == 3) {
+        encoder.call_external("array_error");
+      } else if (i.nArgs()->value() == 4) {
+        encoder.call_external("tensor_error");
+      }
+    }
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_reg_inc_dec &i) {
+    encoder.inc_dec(i.op(), i.dst());
+  }
+
+  void ObjectCodeGenBehavior::act(Instruction_lea &i) {
+    encoder.lea(i.dst(), i.lhs(), i.rhs(), i.scale()->value());
+  }
+
+  void ObjectCodeGenBehavior::write(const std::string& path) const {
+    std::vector<ObjectSymbol> symbols;
+    for (const auto& [name, section, offset] : functionSymbols) {
+      symbols.push_back({name, section, offset, false, true});
+    }
+    const LabelPosition& go = encoder.label_position("go");
+    symbols.push_back({"go", go.section, go.offset, true, true});
+
+    // Labels resolve against the start of whichever section they landed in
+    std::vector<ObjectRelocation> relocations;
+    for (const auto& f : encoder.unresolved_fixups()) {
+      const LabelPosition& target = encoder.label_position(f.label);
+      if (f.absolute) {
+        relocations.push_back({f.section, f.at, "", target.section, R_X86_64_32S, (int64_t)target.offset});
+      } else {
+        relocations.push_back({f.section, f.at, "", target.section, R_X86_64_PC32, (int64_t)target.offset - 4});
+      }
+    }
+    std::set<std::string> runtime;
+    for (const auto& c : encoder.external_calls()) {
+      if (runtime.insert(c.symbol).second) {
+        symbols.push_back({c.symbol, hot_text, 0, true, false});
+      }
+      relocations.push_back({c.section, c.at, c.symbol, hot_text, R_X86_64_PLT32, -4});
+    }
+    write_elf_object(path, encoder.bytes(), symbols, relocations);
+  }
+
+  void generate_object(Program p, CallConvention convention, bool selectEncodings, bool verbose){
+    ObjectCodeGenBehavior b(convention, selectEncodings);
+    p.accept(b);
+    b.write("prog.o");
+    if (verbose) {
+      b.encodings().report(std::cerr);
+    }
+    return ;
+  }
+}
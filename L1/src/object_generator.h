@@ -0,0 +1,48 @@
+#pragma once
+
+#include <tuple>
+
+#include <code_generator.h>
+#include <x86_encoder.h>
+
+namespace L1{
+
+  /*
+   * Same lowering as CodeGenBehavior, but encoded straight to machine code and
+   * written out as a relocatable ELF object instead of AT&T text.
+   */
+  class ObjectCodeGenBehavior : public Behavior {
+    public:
+      ObjectCodeGenBehavior(CallConvention convention, bool selectEncodings);
+      void act(Program &p) override;
+      void act(Function &f) override;
+      void act(Instruction_assignment &i) override;
+      virtual void act(Instruction_aop &i) override;
+      virtual void act(Instruction_sop &i) override;
+      virtual void act(Instruction_mem_aop &i) override;
+      virtual void act(Instruction_cmp_assignment &i) override;
+      virtual void act(Instruction_cjump &i) override;
+      virtual void act(Instruction_label &i) override;
+      virtual void act(Instruction_goto &i) override;
+      virtual void act(Instruction_ret &i) override;
+      virtual void act(Instruction_call &i) override;
+      virtual void act(Instruction_reg_inc_dec &i) override;
+      virtual void act(Instruction_lea &i) override;
+
+      void write(const std::string& path) const;
+      const EncodingSelector& encodings() const;
+
+    private:
+      void move(const Item* dst, const Item* src);
+      void compare(const Item* left, const Item* right);
+
+      int64_t cur_frame_size;
+      CallConvention convention;
+      X86Encoder encoder;
+      EncodingSelector selector;
+      std::vector<std::tuple<std::string, TextSection, size_t>> functionSymbols;
+  };
+
+  void generate_object(Program p, CallConvention convention = label_return, bool selectEncodings = false, bool verbose = false);
+
+}
@@ -0,0 +1,220 @@
+#include <peephole.h>
+
+namespace L1 {
+
+  static const Register* as_register(const Item* item) {
+    return dynamic_cast<const Register*>(item);
+  }
+
+  static const Memory* as_memory(const Item* item) {
+    return dynamic_cast<const Memory*>(item);
+  }
+
+  static bool same(const Item* a, const Item* b) {
+    return a->emit() == b->emit();
+  }
+
+  static void erase(std::vector<Instruction*>& instructions, size_t i) {
+    delete instructions[i];
+    instructions.erase(instructions.begin() + i);
+  }
+
+  static void replace(std::vector<Instruction*>& instructions, size_t i, Instruction* with) {
+    delete instructions[i];
+    instructions[i] = with;
+  }
+
+  // r <- r
+  static bool self_move(std::vector<Instruction*>& instructions, size_t i) {
+    auto *a = dynamic_cast<const Instruction_assignment*>(instructions[i]);
+    if (a == nullptr || !as_register(a->dst()) || !as_register(a->src()) || !same(a->dst(), a->src())) return false;
+    erase(instructions, i);
+    return true;
+  }
+
+  // r += 0, r -= 0, r *= 1, r &= -1, r <<= 0, r >>= 0 and the same on memory
+  static bool identity_arithmetic(std::vector<Instruction*>& instructions, size_t i) {
+    auto identity = [](AOP op, const Item* rhs) {
+      auto *n = dynamic_cast<const Number*>(rhs);
+      if (n == nullptr) return false;
+      switch (op) {
+        case plus_equal:
+        case minus_equal: return n->value() == 0;
+        case times_equal: return n->value() == 1;
+        case and_equal: return n->value() == -1;
+      }
+      return false;
+    };
+    bool drop = false;
+    if (auto *a = dynamic_cast<const Instruction_aop*>(instructions[i])) {
+      drop = identity(a->aop(), a->rhs());
+    } else if (auto *m = dynamic_cast<const Instruction_mem_aop*>(instructions[i])) {
+      drop = as_memory(m->lhs()) && identity(m->aop(), m->rhs());
+    } else if (auto *s = dynamic_cast<const Instruction_sop*>(instructions[i])) {
+      auto *n = dynamic_cast<const Number*>(s->src());
+      drop = n != nullptr && n->value() == 0;
+    }
+    if (!drop) return false;
+    erase(instructions, i);
+    return true;
+  }
+
+  // r *= 2^k  =>  r <<= k;  r *= 3, 5, 9  =>  r @ r r 2, 4, 8;  r *= 0  =>  r <- 0
+  static bool strength_reduction(std::vector<Instruction*>& instructions, size_t i) {
+    auto *a = dynamic_cast<const Instruction_aop*>(instructions[i]);
+    if (a == nullptr || a->aop() != times_equal) return false;
+    auto *n = dynamic_cast<const Number*>(a->rhs());
+    if (n == nullptr) return false;
+    Register* r = const_cast<Register*>(a->dst());
+    int64_t v = n->value();
+    if (v == 0) {
+      replace(instructions, i, new Instruction_assignment(r, new Number(0)));
+    } else if (v > 1 && (v & (v - 1)) == 0) {
+      replace(instructions, i, new Instruction_sop(r, left_shift, new Number(__builtin_ctzll(v))));
+    } else if (v == 3 || v == 5 || v == 9) {
+      replace(instructions, i, new Instruction_lea(r, r, r, new Number(v - 1)));
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // r <- n; r op m  =>  r <- (n op m)
+  static bool constant_folding(std::vector<Instruction*>& instructions, size_t i) {
+    if (i + 1 >= instructions.size()) return false;
+    auto *move = dynamic_cast<const Instruction_assignment*>(instructions[i]);
+    if (move == nullptr || !as_register(move->dst())) return false;
+    auto *n = dynamic_cast<const Number*>(move->src());
+    if (n == nullptr) return false;
+    // Arithmetic wraps like the hardware does
+    uint64_t x = n->value();
+    const Item* rhs = nullptr;
+    if (auto *a = dynamic_cast<const Instruction_aop*>(instructions[i + 1])) {
+      auto *m = dynamic_cast<const Number*>(a->rhs());
+      if (m == nullptr || !same(a->dst(), move->dst())) return false;
+      uint64_t y = m->value();
+      x = a->aop() == plus_equal ? x + y : a->aop() == minus_equal ? x - y : a->aop() == times_equal ? x * y : x & y;
+      rhs = m;
+    } else if (auto *s = dynamic_cast<const Instruction_sop*>(instructions[i + 1])) {
+      auto *m = dynamic_cast<const Number*>(s->src());
+      if (m == nullptr || !same(s->dst(), move->dst())) return false;
+      int shift = m->value() & 63;
+      x = s->sop() == left_shift ? x << shift : (uint64_t)((int64_t)x >> shift);
+      rhs = m;
+    }
+    if (rhs == nullptr) return false;
+    erase(instructions, i + 1);
+    replace(instructions, i, new Instruction_assignment(const_cast<Item*>(move->dst()), new Number((int64_t)x)));
+    return true;
+  }
+
+  // goto :L or cjump ... :L when :L is among the labels right after it
+  static bool jump_to_next(std::vector<Instruction*>& instructions, size_t i) {
+    const Label* target = nullptr;
+    if (auto *g = dynamic_cast<const Instruction_goto*>(instructions[i])) {
+      target = g->label();
+    } else if (auto *c = dynamic_cast<const Instruction_cjump*>(instructions[i])) {
+      target = c->label();
+    }
+    if (target == nullptr) return false;
+    for (size_t k = i + 1; k < instructions.size(); k++) {
+      auto *l = dynamic_cast<const Instruction_label*>(instructions[k]);
+      if (l == nullptr) return false;
+      if (same(l->label(), target)) {
+        erase(instructions, i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // mem x M <- s; r <- mem x M  =>  mem x M <- s; r <- s
+  static bool store_load_forwarding(std::vector<Instruction*>& instructions, size_t i) {
+    if (i + 1 >= instructions.size()) return false;
+    auto *store = dynamic_cast<const Instruction_assignment*>(instructions[i]);
+    auto *load = dynamic_cast<const Instruction_assignment*>(instructions[i + 1]);
+    if (store == nullptr || load == nullptr || !as_memory(store->dst()) || !as_memory(load->src())) return false;
+    if (!same(store->dst(), load->src())) return false;
+    if (same(load->dst(), store->src())) {
+      erase(instructions, i + 1);
+    } else {
+      replace(instructions, i + 1, new Instruction_assignment(const_cast<Item*>(load->dst()), const_cast<Item*>(store->src())));
+    }
+    return true;
+  }
+
+  // r <- mem x M; r2 <- mem x M  =>  r <- mem x M; r2 <- r   (x is not r)
+  static bool load_reuse(std::vector<Instruction*>& instructions, size_t i) {
+    if (i + 1 >= instructions.size()) return false;
+    auto *first = dynamic_cast<const Instruction_assignment*>(instructions[i]);
+    auto *second = dynamic_cast<const Instruction_assignment*>(instructions[i + 1]);
+    if (first == nullptr || second == nullptr) return false;
+    auto *m = as_memory(first->src());
+    if (m == nullptr || !as_memory(second->src()) || !same(m, second->src()) || same(m->getReg(), first->dst())) return false;
+    if (same(first->dst(), second->dst())) {
+      erase(instructions, i + 1);
+    } else {
+      replace(instructions, i + 1, new Instruction_assignment(const_cast<Item*>(second->dst()), const_cast<Item*>(first->dst())));
+    }
+    return true;
+  }
+
+  // r <- mem x M; mem x M <- r  =>  r <- mem x M   (x is not r)
+  static bool redundant_store(std::vector<Instruction*>& instructions, size_t i) {
+    if (i + 1 >= instructions.size()) return false;
+    auto *load = dynamic_cast<const Instruction_assignment*>(instructions[i]);
+    auto *store = dynamic_cast<const Instruction_assignment*>(instructions[i + 1]);
+    if (load == nullptr || store == nullptr) return false;
+    auto *m = as_memory(load->src());
+    if (m == nullptr || !as_memory(store->dst()) || !same(m, store->dst()) || same(m->getReg(), load->dst())) return false;
+    if (!same(load->dst(), store->src())) return false;
+    erase(instructions, i + 1);
+    return true;
+  }
+
+  PeepholeOptimizer::PeepholeOptimizer()
+    : patterns {
+        {"self-move", self_move},
+        {"identity-arithmetic", identity_arithmetic},
+        {"constant-folding", constant_folding},
+        {"strength-reduction", strength_reduction},
+        {"jump-to-next", jump_to_next},
+        {"store-load-forwarding", store_load_forwarding},
+        {"load-reuse", load_reuse},
+        {"redundant-store", redundant_store},
+      } {
+      return;
+    }
+
+  void PeepholeOptimizer::optimize(Function& f) {
+    // One rewrite can expose another, so sweep until the list stops changing
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = 0; i < f.instructions.size(); i++) {
+        for (auto& pattern : patterns) {
+          if (i < f.instructions.size() && pattern.rewrite(f.instructions, i)) {
+            pattern.hits++;
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+
+  void PeepholeOptimizer::report(std::ostream& out) const {
+    for (const auto& pattern : patterns) {
+      out << "peephole " << pattern.name << ": " << pattern.hits << " hits\n";
+    }
+  }
+
+  void optimize_peephole(Program& p, bool verbose) {
+    PeepholeOptimizer optimizer;
+    for (Function* f : p.functions) {
+      optimizer.optimize(*f);
+    }
+    if (verbose) {
+      optimizer.report(std::cerr);
+    }
+  }
+}
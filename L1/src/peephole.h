@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <L1.h>
+
+namespace L1 {
+
+  /*
+   * A rewrite looks at the window starting at instructions[i]. When it matches it
+   * edits the list in place, deleting whatever it drops, and returns true.
+   */
+  using PeepholeRewrite = bool (*)(std::vector<Instruction*>& instructions, size_t i);
+
+  struct PeepholePattern {
+    std::string name;
+    PeepholeRewrite rewrite;
+    size_t hits = 0;
+  };
+
+  class PeepholeOptimizer {
+    public:
+      PeepholeOptimizer();
+      void optimize(Function& f);
+      void report(std::ostream& out) const;
+
+    private:
+      std::vector<PeepholePattern> patterns;
+  };
+
+  void optimize_peephole(Program& p, bool verbose);
+
+}
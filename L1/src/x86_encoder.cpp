@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <x86_encoder.h>
+
+namespace L1 {
+
+  static int machine_code(RegisterID id) {
+    switch (id) {
+      case rax: return 0;
+      case rcx: return 1;
+      case rdx: return 2;
+      case rbx: return 3;
+      case rsp: return 4;
+      case rbp: return 5;
+      case rsi: return 6;
+      case rdi: return 7;
+      case r8:  return 8;
+      case r9:  return 9;
+      case r10: return 10;
+      case r11: return 11;
+      case r12: return 12;
+      case r13: return 13;
+      case r14: return 14;
+      case r15: return 15;
+    }
+    throw std::runtime_error("invalid register");
+  }
+
+  static int machine_code(const Register* r) {
+    return machine_code(r->getID());
+  }
+
+  // Mirrors jump_assembly_from_cmp: l, le, e, g, ge
+  static uint8_t condition_code(CMP cmp, bool flip) {
+    switch (cmp) {
+      case less_than:       return flip ? 0xF : 0xC;
+      case less_than_equal: return flip ? 0xD : 0xE;
+      case equal:           return 0x4;
+    }
+    throw std::runtime_error("bad CMP");
+  }
+
+  static bool fits_int8(int64_t v) {
+    return v >= INT8_MIN && v <= INT8_MAX;
+  }
+
+  static bool fits_int32(int64_t v) {
+    return v >= INT32_MIN && v <= INT32_MAX;
+  }
+
+  // Labels and functions both live in .text under the names the text backend gives them
+  static std::string symbol_of(const Item* item) {
+    EmitOptions options;
+    options.functionCall = true;
+    return item->emit(options);
+  }
+
+  void X86Encoder::byte(uint8_t b) {
+    code[current].push_back(b);
+  }
+
+  void X86Encoder::imm32(int64_t v) {
+    if (!fits_int32(v)) throw std::runtime_error("immediate " + std::to_string(v) + " does not fit in 32 bits");
+    for (int k = 0; k < 4; k++) byte((uint64_t)v >> (8 * k));
+  }
+
+  void X86Encoder::imm64(int64_t v) {
+    for (int k = 0; k < 8; k++) byte((uint64_t)v >> (8 * k));
+  }
+
+  void X86Encoder::label_field(const std::string& label, bool absolute) {
+    fixups.push_back({current, offset(), label, absolute});
+    imm32(0);
+  }
+
+  void X86Encoder::rex(bool wide, int reg, int index, int base, bool byteRegs) {
+    uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((index & 8) ? 2 : 0) | ((base & 8) ? 1 : 0);
+    // spl, bpl, sil and dil only exist with a REX prefix
+    bool lowByte = byteRegs && ((reg >= 4 && reg <= 7) || (base >= 4 && base <= 7));
+    if (prefix != 0x40 || lowByte) byte(prefix);
+  }
+
+  /*
+   * Opcode plus ModRM for "reg, r/m", where r/m is a register or a base+offset
+   * memory operand. rsp and r12 as a base need a SIB byte; rbp and r13 always
+   * carry a displacement.
+   */
+  void X86Encoder::modrm(std::initializer_list<uint8_t> opcode, int reg, const Item* rm, bool wide, bool byteRegs) {
+    if (auto *r = dynamic_cast<const Register*>(rm)) {
+      int b = machine_code(r);
+      rex(wide, reg, 0, b, byteRegs);
+      for (uint8_t o : opcode) byte(o);
+      byte(0xC0 | ((reg & 7) << 3) | (b & 7));
+      return;
+    }
+    auto *m = dynamic_cast<const Memory*>(rm);
+    if (m == nullptr) throw std::runtime_error("operand is neither a register nor memory");
+    int b = machine_code(m->getReg());
+    int64_t disp = m->getOffset()->value();
+    rex(wide, reg, 0, b, byteRegs);
+    for (uint8_t o : opcode) byte(o);
+    uint8_t mod = (disp == 0 && (b & 7) != 5) ? 0 : fits_int8(disp) ? 1 : 2;
+    byte((mod << 6) | ((reg & 7) << 3) | (b & 7));
+    if ((b & 7) == 4) byte(0x24);
+    if (mod == 1) byte(disp);
+    if (mod == 2) imm32(disp);
+  }
+
+  // The 0x83/0x81 group: add /0, and /4, sub /5, cmp /7
+  void X86Encoder::immediate_op(uint8_t ext, const Item* rm, int64_t value) {
+    if (fits_int8(value)) {
+      modrm({0x83}, ext, rm);
+      byte(value);
+    } else {
+      modrm({0x81}, ext, rm);
+      imm32(value);
+    }
+  }
+
+  void X86Encoder::mov(const Item* dst, const Item* src) {
+    auto *dstReg = dynamic_cast<const Register*>(dst);
+    if (auto *r = dynamic_cast<const Register*>(src)) {
+      modrm({0x89}, machine_code(r), dst);
+    } else if (auto *m = dynamic_cast<const Memory*>(src)) {
+      if (dstReg == nullptr) throw std::runtime_error("memory to memory move");
+      modrm({0x8B}, machine_code(dstReg), m);
+    } else if (auto *n = dynamic_cast<const Number*>(src)) {
+      if (dstReg != nullptr && !fits_int32(n->value())) {
+        int d = machine_code(dstReg);
+        rex(true, 0, 0, d, false);
+        byte(0xB8 | (d & 7));
+        imm64(n->value());
+        return;
+      }
+      modrm({0xC7}, 0, dst);
+      imm32(n->value());
+    } else {
+      // A label or function address, sign-extended from 32 bits like movq $sym
+      modrm({0xC7}, 0, dst);
+      label_field(symbol_of(src), true);
+    }
+  }
+
+  void X86Encoder::zero32(const Register* dst) {
+    modrm({0x31}, machine_code(dst), dst, false);
+  }
+
+  void X86Encoder::mov32(const Register* dst, uint32_t value) {
+    int d = machine_code(dst);
+    rex(false, 0, 0, d, false);
+    byte(0xB8 | (d & 7));
+    for (int k = 0; k < 4; k++) byte(value >> (8 * k));
+  }
+
+  void X86Encoder::test(const Register* r) {
+    modrm({0x85}, machine_code(r), r);
+  }
+
+  void X86Encoder::aop(AOP op, const Item* dst, const Item* src) {
+    auto *dstReg = dynamic_cast<const Register*>(dst);
+    if (op == times_equal) {
+      if (dstReg == nullptr) throw std::runtime_error("imulq needs a register destination");
+      if (auto *n = dynamic_cast<const Number*>(src)) {
+        int d = machine_code(dstReg);
+        if (fits_int8(n->value())) {
+          modrm({0x6B}, d, dst);
+          byte(n->value());
+        } else {
+          modrm({0x69}, d, dst);
+          imm32(n->value());
+        }
+        return;
+      }
+      modrm({0x0F, 0xAF}, machine_code(dstReg), src);
+      return;
+    }
+
+    uint8_t ext = op == plus_equal ? 0 : op == and_equal ? 4 : 5;
+    uint8_t store = op == plus_equal ? 0x01 : op == and_equal ? 0x21 : 0x29;
+    if (auto *n = dynamic_cast<const Number*>(src)) {
+      immediate_op(ext, dst, n->value());
+    } else if (auto *r = dynamic_cast<const Register*>(src)) {
+      modrm({store}, machine_code(r), dst);
+    } else {
+      if (dstReg == nullptr) throw std::runtime_error("memory to memory arithmetic");
+      modrm({(uint8_t)(store + 2)}, machine_code(dstReg), src);
+    }
+  }
+
+  void X86Encoder::shift(SOP op, const Register* dst, const Item* amount) {
+    uint8_t ext = op == left_shift ? 4 : 7;
+    auto *n = dynamic_cast<const Number*>(amount);
+    if (n != nullptr && n->value() == 1) {
+      // Shift-by-one has its own opcode with no immediate, as the assembler picks
+      modrm({0xD1}, ext, dst);
+    } else if (n != nullptr) {
+      modrm({0xC1}, ext, dst);
+      byte(n->value());
+    } else {
+      // The only variable shift count x86 has is %cl
+      modrm({0xD3}, ext, dst);
+    }
+  }
+
+  void X86Encoder::inc_dec(IncDec op, const Register* dst) {
+    modrm({0xFF}, op == increment ? 0 : 1, dst);
+  }
+
+  void X86Encoder::lea(const Register* dst, const Register* base, const Register* index, int64_t scale) {
+    int d = machine_code(dst), b = machine_code(base), x = machine_code(index);
+    if (x == 4) throw std::runtime_error("rsp cannot be an index register");
+    uint8_t scaleBits = scale == 1 ? 0 : scale == 2 ? 1 : scale == 4 ? 2 : 3;
+    rex(true, d, x, b, false);
+    byte(0x8D);
+    bool disp8 = (b & 7) == 5;
+    byte(((disp8 ? 1 : 0) << 6) | ((d & 7) << 3) | 4);
+    byte((scaleBits << 6) | ((x & 7) << 3) | (b & 7));
+    if (disp8) byte(0);
+  }
+
+  void X86Encoder::cmp(const Item* left, const Item* right) {
+    if (auto *n = dynamic_cast<const Number*>(left)) {
+      immediate_op(7, right, n->value());
+      return;
+    }
+    modrm({0x39}, machine_code(dynamic_cast<const Register*>(left)), right);
+  }
+
+  void X86Encoder::setcc(CMP cmp, bool flip, const Register* dst) {
+    modrm({0x0F, (uint8_t)(0x90 | condition_code(cmp, flip))}, 0, dst, false, true);
+  }
+
+  void X86Encoder::movzx8(const Register* r) {
+    modrm({0x0F, 0xB6}, machine_code(r), r);
+  }
+
+  void X86Encoder::jcc(CMP cmp, bool flip, const std::string& label) {
+    byte(0x0F);
+    byte(0x80 | condition_code(cmp, flip));
+    label_field(label, false);
+  }
+
+  void X86Encoder::jmp(const std::string& label) {
+    byte(0xE9);
+    label_field(label, false);
+  }
+
+  void X86Encoder::jmp(const Register* target) {
+    modrm({0xFF}, 4, target, false);
+  }
+
+  void X86Encoder::call(const std::string& label) {
+    byte(0xE8);
+    label_field(label, false);
+  }
+
+  void X86Encoder::call(const Register* target) {
+    modrm({0xFF}, 2, target, false);
+  }
+
+  void X86Encoder::call_external(const std::string& symbol) {
+    byte(0xE8);
+    externals.push_back({current, offset(), symbol});
+    imm32(0);
+  }
+
+  void X86Encoder::ret() {
+    byte(0xC3);
+  }
+
+  void X86Encoder::push(RegisterID r) {
+    int c = machine_code(r);
+    rex(false, 0, 0, c, false);
+    byte(0x50 | (c & 7));
+  }
+
+  void X86Encoder::pop(RegisterID r) {
+    int c = machine_code(r);
+    rex(false, 0, 0, c, false);
+    byte(0x58 | (c & 7));
+  }
+
+  void X86Encoder::adjust_rsp(int64_t delta) {
+    Register stack(rsp);
+    if (delta < 0) {
+      immediate_op(5, &stack, -delta);
+    } else if (delta > 0) {
+      immediate_op(0, &stack, delta);
+    }
+  }
+
+  void X86Encoder::switch_section(TextSection section) {
+    current = section;
+  }
+
+  // The recommended multi-byte nops, one per length from 1 to 9 bytes
+  void X86Encoder::align(int log2, size_t maxSkip) {
+    static const std::vector<uint8_t> nops[] = {
+      {0x90},
+      {0x66, 0x90},
+      {0x0F, 0x1F, 0x00},
+      {0x0F, 0x1F, 0x40, 0x00},
+      {0x0F, 0x1F, 0x44, 0x00, 0x00},
+      {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+      {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+      {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+      {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    };
+    size_t boundary = (size_t)1 << log2;
+    size_t padding = (boundary - offset() % boundary) % boundary;
+    if (padding > maxSkip) return;
+    while (padding > 0) {
+      size_t n = std::min<size_t>(padding, 9);
+      for (uint8_t b : nops[n - 1]) byte(b);
+      padding -= n;
+    }
+  }
+
+  void X86Encoder::define_label(const std::string& label) {
+    labels[label] = {current, offset()};
+  }
+
+  size_t X86Encoder::offset() const {
+    return code[current].size();
+  }
+
+  const LabelPosition& X86Encoder::label_position(const std::string& label) const {
+    auto it = labels.find(label);
+    if (it == labels.end()) throw std::runtime_error("undefined label " + label);
+    return it->second;
+  }
+
+  void X86Encoder::finish() {
+    for (const auto& f : fixups) {
+      const LabelPosition& target = label_position(f.label);
+      if (f.absolute || target.section != f.section) continue;
+      int64_t rel = (int64_t)target.offset - (int64_t)(f.at + 4);
+      for (int k = 0; k < 4; k++) code[f.section][f.at + k] = (uint64_t)rel >> (8 * k);
+    }
+  }
+
+  const TextSections& X86Encoder::bytes() const {
+    return code;
+  }
+
+  std::vector<LabelFixup> X86Encoder::unresolved_fixups() const {
+    std::vector<LabelFixup> unresolved;
+    for (const auto& f : fixups) {
+      if (f.absolute || label_position(f.label).section != f.section) unresolved.push_back(f);
+    }
+    return unresolved;
+  }
+
+  const std::vector<ExternalCall>& X86Encoder::external_calls() const {
+    return externals;
+  }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <L1.h>
+#include <elf_writer.h>
+
+namespace L1 {
+
+  struct LabelPosition {
+    TextSection section;
+    size_t offset;
+  };
+
+  // A 32-bit field that refers to a label placed somewhere in .text or .text.unlikely
+  struct LabelFixup {
+    TextSection section;
+    size_t at;
+    std::string label;
+    bool absolute;
+  };
+
+  // A call into the runtime, resolved by the linker
+  struct ExternalCall {
+    TextSection section;
+    size_t at;
+    std::string symbol;
+  };
+
+  /*
+   * Encodes the handful of x86-64 instructions L1 needs straight into bytes.
+   * Operands are L1 items; registers and memory go through the usual ModRM/SIB
+   * forms, and labels are patched once every label in .text has been placed.
+   */
+  class X86Encoder {
+    public:
+      void mov(const Item* dst, const Item* src);
+      void aop(AOP op, const Item* dst, const Item* src);
+      void shift(SOP op, const Register* dst, const Item* amount);
+      void inc_dec(IncDec op, const Register* dst);
+      void lea(const Register* dst, const Register* base, const Register* index, int64_t scale);
+
+      // Short forms: xorl r32, r32; movl $imm, r32 (zero-extends); testq r, r
+      void zero32(const Register* dst);
+      void mov32(const Register* dst, uint32_t value);
+      void test(const Register* r);
+
+      // AT&T order: flags from right - left
+      void cmp(const Item* left, const Item* right);
+      void setcc(CMP cmp, bool flip, const Register* dst);
+      void movzx8(const Register* r);
+      void jcc(CMP cmp, bool flip, const std::string& label);
+
+      void jmp(const std::string& label);
+      void jmp(const Register* target);
+      void call(const std::string& label);
+      void call(const Register* target);
+      void call_external(const std::string& symbol);
+      void ret();
+      void push(RegisterID r);
+      void pop(RegisterID r);
+      void adjust_rsp(int64_t delta);
+
+      // Where the following instructions go, hot text by default
+      void switch_section(TextSection section);
+
+      // Pads with nops to a 2^log2 boundary unless that takes more than maxSkip bytes
+      void align(int log2, size_t maxSkip);
+
+      void define_label(const std::string& label);
+      size_t offset() const;
+
+      // Patches relative label references within a section; the rest are left for the linker
+      void finish();
+
+      const TextSections& bytes() const;
+      std::vector<LabelFixup> unresolved_fixups() const;
+      const std::vector<ExternalCall>& external_calls() const;
+      const LabelPosition& label_position(const std::string& label) const;
+
+    private:
+      void byte(uint8_t b);
+      void imm32(int64_t v);
+      void imm64(int64_t v);
+      void label_field(const std::string& label, bool absolute);
+      void rex(bool wide, int reg, int index, int base, bool byteRegs);
+      void modrm(std::initializer_list<uint8_t> opcode, int reg, const Item* rm, bool wide = true, bool byteRegs = false);
+      void immediate_op(uint8_t ext, const Item* rm, int64_t value);
+
+      TextSections code;
+      TextSection current = hot_text;
+      std::unordered_map<std::string, LabelPosition> labels;
+      std::vector<LabelFixup> fixups;
+      std::vector<ExternalCall> externals;
+  };
+
+}
@@ -28,6 +28,9 @@ namespace L2 {
 
   enum CallType {l1, print, input, allocate, tuple_error, tensor_error}; 
 
+  // label_return stores a return label at mem rsp -8 and jumps; call_return uses call/ret 
+  enum CallConvention {label_return, call_return}; 
+
 
   // Items 
 
@@ -0,0 +1,117 @@
+#include <algorithm>
+
+#include <bit_vector.h>
+
+namespace L2 {
+
+    BitVector::BitVector(size_t bits)
+        : words((bits + 63) / 64, 0) {
+            return;
+        }
+
+    void BitVector::resize(size_t bits) {
+        words.resize((bits + 63) / 64, 0);
+    }
+
+    void BitVector::clear() {
+        std::fill(words.begin(), words.end(), 0);
+    }
+
+    void BitVector::set(size_t i) {
+        if (i / 64 >= words.size()) {
+            words.resize(i / 64 + 1, 0);
+        }
+        words[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+
+    void BitVector::reset(size_t i) {
+        if (i / 64 >= words.size()) return;
+        words[i / 64] &= ~((uint64_t)1 << (i % 64));
+    }
+
+    bool BitVector::test(size_t i) const {
+        if (i / 64 >= words.size()) return false;
+        return (words[i / 64] >> (i % 64)) & 1;
+    }
+
+    bool BitVector::empty() const {
+        for (uint64_t w : words) {
+            if (w) return false;
+        }
+        return true;
+    }
+
+    bool BitVector::intersects(const BitVector& other) const {
+        const size_t n = std::min(words.size(), other.words.size());
+        for (size_t w = 0; w < n; w++) {
+            if (words[w] & other.words[w]) return true;
+        }
+        return false;
+    }
+
+    size_t BitVector::count() const {
+        size_t n = 0;
+        for (uint64_t w : words) {
+            n += __builtin_popcountll(w);
+        }
+        return n;
+    }
+
+    size_t BitVector::size() const {
+        return words.size() * 64;
+    }
+
+    void BitVector::assign(const BitVector& other) {
+        const size_t n = words.size();
+        const uint64_t* src = other.words.data();
+        uint64_t* dst = words.data();
+        for (size_t w = 0; w < n; w++) {
+            dst[w] = src[w];
+        }
+    }
+
+    bool BitVector::union_with(const BitVector& other) {
+        const size_t n = words.size();
+        const uint64_t* src = other.words.data();
+        uint64_t* dst = words.data();
+        uint64_t changed = 0;
+        for (size_t w = 0; w < n; w++) {
+            uint64_t next = dst[w] | src[w];
+            changed |= next ^ dst[w];
+            dst[w] = next;
+        }
+        return changed != 0;
+    }
+
+    void BitVector::subtract(const BitVector& other) {
+        const size_t n = words.size();
+        const uint64_t* src = other.words.data();
+        uint64_t* dst = words.data();
+        for (size_t w = 0; w < n; w++) {
+            dst[w] &= ~src[w];
+        }
+    }
+
+    bool BitVector::assign_transfer(const BitVector& gen, const BitVector& out, const BitVector& kill) {
+        const size_t n = words.size();
+        const uint64_t* g = gen.words.data();
+        const uint64_t* o = out.words.data();
+        const uint64_t* k = kill.words.data();
+        uint64_t* dst = words.data();
+        uint64_t changed = 0;
+        for (size_t w = 0; w < n; w++) {
+            uint64_t next = g[w] | (o[w] & ~k[w]);
+            changed |= next ^ dst[w];
+            dst[w] = next;
+        }
+        return changed != 0;
+    }
+
+    bool BitVector::operator==(const BitVector& other) const {
+        return words == other.words;
+    }
+
+    bool BitVector::operator!=(const BitVector& other) const {
+        return words != other.words;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace L2 {
+
+    /*
+     * Dense set of node indices packed into 64-bit words.
+     * All binary kernels work a word at a time and expect both operands to
+     * have been resized to the same number of bits.
+     */
+    class BitVector {
+        public:
+            BitVector() = default;
+            explicit BitVector(size_t bits);
+
+            void resize(size_t bits);
+            void clear();
+
+            void set(size_t i);
+            void reset(size_t i);
+            bool test(size_t i) const;
+
+            bool empty() const;
+            bool intersects(const BitVector& other) const;
+            size_t count() const;
+            size_t size() const;
+
+            void assign(const BitVector& other);
+            bool union_with(const BitVector& other);
+            void subtract(const BitVector& other);
+
+            // this = gen U (out - kill), returns true if this changed
+            bool assign_transfer(const BitVector& gen, const BitVector& out, const BitVector& kill);
+
+            bool operator==(const BitVector& other) const;
+            bool operator!=(const BitVector& other) const;
+
+            template <class F>
+            void for_each(F f) const {
+                for (size_t w = 0; w < words.size(); w++) {
+                    uint64_t bits = words[w];
+                    while (bits) {
+                        size_t b = __builtin_ctzll(bits);
+                        f(w * 64 + b);
+                        bits &= bits - 1;
+                    }
+                }
+            }
+
+        private:
+            std::vector<uint64_t> words;
+    };
+}
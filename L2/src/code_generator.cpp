@@ -37,7 +37,10 @@ namespace L2{
     EmitOptions options; 
     options.l2tol1 = true; 
     options.coloring = &colorInputs[cur_f]; 
-    out << "  " << i.dst()->emit(options) << " <- " << i.src()->emit(options) << "\n";
+    std::string dst = i.dst()->emit(options); 
+    std::string src = i.src()->emit(options); 
+    if (dst == src) return; // coalesced move 
+    out << "  " << dst << " <- " << src << "\n";
 
   }
 
@@ -140,7 +143,7 @@ namespace L2{
     EmitOptions options; 
     options.l2tol1 = true; 
     options.coloring = &colorInputs[cur_f];
-    out << "  " << i.dst()->emit(options) << " @ " << i.lhs()->emit(options) << " " << i.rhs()->emit(options) << i.scale()->emit(options) << "\n"; 
+    out << "  " << i.dst()->emit(options) << " @ " << i.lhs()->emit(options) << " " << i.rhs()->emit(options) << " " << i.scale()->emit(options) << "\n"; 
   } 
 
 
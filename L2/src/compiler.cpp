@@ -28,7 +28,7 @@ std::string read_file(const char *path) {
 }
 
 void print_help (char *progName){
-  std::cerr << "Usage: " << progName << " [-v] [-i] [-g 0|1] [-O 0|1|2] SOURCE" << std::endl;
+  std::cerr << "Usage: " << progName << " [-v] [-i] [-g 0|1] [-O 0|1|2] [-j N] [-m N] [-c jmp|call] SOURCE" << std::endl;
   return ;
 }
 
@@ -39,8 +39,11 @@ int main(
   auto enable_code_generator = false;
   auto liveness_analysis = false; 
   bool interference = false; 
-  int32_t optLevel = 0;
-  bool verbose;
+  int32_t optLevel = 1;
+  bool verbose = false;
+  size_t jobs = 1;
+  size_t linearScanAbove = L2::defaultLinearScanAbove;
+  L2::CallConvention convention = L2::label_return;
 
   /* 
    * Check the compiler arguments.
@@ -50,7 +53,7 @@ int main(
     return 1;
   }
   int32_t opt;
-  while ((opt = getopt(argc, argv, "vlig:O:")) != -1) {
+  while ((opt = getopt(argc, argv, "vlig:O:j:m:c:")) != -1) {
     switch (opt){
       case 'O':
         optLevel = strtoul(optarg, NULL, 0);
@@ -60,6 +63,18 @@ int main(
         enable_code_generator = (strtoul(optarg, NULL, 0) == 0) ? false : true ;
         break ;
 
+      case 'j':
+        jobs = strtoul(optarg, NULL, 0);
+        break ;
+
+      case 'm':
+        linearScanAbove = strtoul(optarg, NULL, 0);
+        break ;
+
+      case 'c':
+        convention = L2::convention_from_string(optarg);
+        break ;
+
       case 'v':
         verbose = true;
         break ;
@@ -99,7 +114,11 @@ int main(
    * Perform liveness analysis 
    */
 
-  L2::analyze_liveness(p); 
+  // -O0 trades code quality for speed: linear scan everywhere 
+  if (optLevel == 0) {
+    linearScanAbove = 0;
+  }
+  L2::analyze_liveness(p, verbose, jobs, linearScanAbove, convention, optLevel > 0); 
 
   return 0;
 }
@@ -0,0 +1,64 @@
+#include <algorithm>
+
+#include <degree_buckets.h>
+
+namespace L2 {
+
+    void DegreeBuckets::reset(size_t nodes) {
+        heads.assign(nodes + 1, none);
+        next.assign(nodes, none);
+        prev.assign(nodes, none);
+        degreeOf.assign(nodes, none);
+        maxDegree = 0;
+    }
+
+    void DegreeBuckets::insert(size_t node, size_t degree) {
+        if (degree >= heads.size()) {
+            heads.resize(degree + 1, none);
+        }
+        degreeOf[node] = degree;
+        prev[node] = none;
+        next[node] = heads[degree];
+        if (heads[degree] != none) {
+            prev[heads[degree]] = node;
+        }
+        heads[degree] = node;
+        maxDegree = std::max(maxDegree, degree);
+    }
+
+    void DegreeBuckets::remove(size_t node) {
+        size_t degree = degreeOf[node];
+        if (degree == none) return;
+        if (prev[node] != none) {
+            next[prev[node]] = next[node];
+        } else {
+            heads[degree] = next[node];
+        }
+        if (next[node] != none) {
+            prev[next[node]] = prev[node];
+        }
+        degreeOf[node] = none;
+    }
+
+    void DegreeBuckets::move(size_t node, size_t degree) {
+        remove(node);
+        insert(node, degree);
+    }
+
+    bool DegreeBuckets::contains(size_t node) const {
+        return degreeOf[node] != none;
+    }
+
+    size_t DegreeBuckets::pick_max(size_t limit) {
+        size_t d = std::min(limit, maxDegree);
+        while (heads[d] == none) {
+            if (d == 0) {
+                if (limit >= maxDegree) maxDegree = 0;
+                return none;
+            }
+            d--;
+        }
+        if (limit >= maxDegree) maxDegree = d;
+        return heads[d];
+    }
+}
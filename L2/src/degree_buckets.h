@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace L2 {
+
+    /*
+     * Nodes bucketed by their current degree, each bucket an intrusive
+     * doubly-linked list, so insertion, removal and degree changes are O(1).
+     * The highest non-empty bucket is found by walking down from a cached
+     * maximum that only moves when a higher degree is inserted.
+     */
+    class DegreeBuckets {
+        public:
+            static constexpr size_t none = SIZE_MAX;
+
+            void reset(size_t nodes);
+
+            void insert(size_t node, size_t degree);
+            void remove(size_t node);
+            void move(size_t node, size_t degree);
+            bool contains(size_t node) const;
+
+            // A node from the highest non-empty bucket whose degree is <= limit
+            size_t pick_max(size_t limit = none);
+
+        private:
+            std::vector<size_t> heads;
+            std::vector<size_t> next;
+            std::vector<size_t> prev;
+            std::vector<size_t> degreeOf;
+            size_t maxDegree = 0;
+    };
+}
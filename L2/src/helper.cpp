@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <unordered_map>
+
 #include <helper.h>
 
 namespace L2 {
@@ -236,6 +239,129 @@ namespace L2 {
     return res; 
   }
 
+  CallConvention convention_from_string(std::string_view s) {
+    return s == "jmp" ? CallConvention::label_return:
+           s == "call" ? CallConvention::call_return:
+           throw std::runtime_error("bad calling convention");
+  }
+
+  static bool is_return_address_store(const Instruction* i) {
+    auto *a = dynamic_cast<const Instruction_assignment*>(i); 
+    if (a == nullptr || a->src()->kind() != ItemType::LabelItem || a->dst()->kind() != ItemType::MemoryItem) return false; 
+    auto *m = dynamic_cast<const Memory*>(a->dst()); 
+    return m->getVar()->emit() == "%rsp" && m->getOffset()->value() == -8; 
+  }
+
+  /*
+   * Under call_return the call instruction pushes its own return address into mem rsp -8, 
+   * so a label stored there for the next L1 call is dead. The store goes, and so does the 
+   * return label once nothing else refers to it. 
+   */
+  void drop_return_address_stores(Program& p) {
+    for (Function* f : p.functions) {
+      auto& instructions = f->instructions; 
+      std::unordered_map<std::string, size_t> references; 
+      for (Instruction* i : instructions) {
+        if (auto *a = dynamic_cast<const Instruction_assignment*>(i)) {
+          if (a->src()->kind() == ItemType::LabelItem) references[a->src()->emit()]++; 
+        } else if (auto *g = dynamic_cast<const Instruction_goto*>(i)) {
+          references[g->label()->emit()]++; 
+        } else if (auto *c = dynamic_cast<const Instruction_cjump*>(i)) {
+          references[c->label()->emit()]++; 
+        }
+      }
+
+      std::vector<char> dropped(instructions.size(), 0); 
+      for (size_t j = 0; j < instructions.size(); j++) {
+        if (!is_return_address_store(instructions[j])) continue; 
+        // Only argument setup may sit between the store and the call it is for 
+        size_t k = j + 1; 
+        while (k < instructions.size() && (dynamic_cast<const Instruction_assignment*>(instructions[k]) 
+            || dynamic_cast<const Instruction_stack_arg_assignment*>(instructions[k]))) {
+          k++; 
+        }
+        auto *call = k < instructions.size() ? dynamic_cast<const Instruction_call*>(instructions[k]) : nullptr; 
+        if (call == nullptr || call->callType() != CallType::l1) continue; 
+        std::string ret = dynamic_cast<const Instruction_assignment*>(instructions[j])->src()->emit(); 
+        dropped[j] = 1; 
+        references[ret]--; 
+        auto *label = k + 1 < instructions.size() ? dynamic_cast<const Instruction_label*>(instructions[k + 1]) : nullptr; 
+        if (label != nullptr && label->label()->emit() == ret && references[ret] == 0) { 
+          dropped[k + 1] = 1; 
+        }
+      }
+
+      size_t kept = 0; 
+      for (size_t j = 0; j < instructions.size(); j++) {
+        if (dropped[j]) {
+          delete instructions[j]; 
+        } else {
+          instructions[kept++] = instructions[j]; 
+        }
+      }
+      instructions.resize(kept); 
+    }
+  }
+
+  // '-' never appears in a parsed variable, so these names cannot collide with the program's 
+  std::string callee_save_variable(RegisterID r) {
+    return "%callee-" + string_from_register(r); 
+  }
+
+  /*
+   * The return uses every callee-saved register, so each one is live from entry to every 
+   * return and a variable that crosses a call interferes with all fifteen registers. Copying 
+   * them into variables on entry and back before each return lets the allocator coalesce 
+   * the copies away when a register goes unused, or spill them and hand the register to 
+   * variables that live across calls. A call that is returned straight away gets the 
+   * restores in front of it instead, so L1 can still turn the pair into a tail jump. 
+   */
+  void save_callee_saved_registers(Program& p) {
+    for (Function* f : p.functions) {
+      auto& instructions = f->instructions; 
+      if (std::none_of(instructions.begin(), instructions.end(), [](const Instruction* i) {
+        return dynamic_cast<const Instruction_ret*>(i) != nullptr; 
+      })) continue; 
+
+      std::unordered_map<std::string, size_t> references; 
+      for (Instruction* i : instructions) {
+        if (auto *a = dynamic_cast<const Instruction_assignment*>(i)) {
+          if (a->src()->kind() == ItemType::LabelItem) references[a->src()->emit()]++; 
+        } else if (auto *g = dynamic_cast<const Instruction_goto*>(i)) {
+          references[g->label()->emit()]++; 
+        } else if (auto *c = dynamic_cast<const Instruction_cjump*>(i)) {
+          references[c->label()->emit()]++; 
+        }
+      }
+
+      std::vector<Instruction*> rewritten; 
+      for (RegisterID r : calleeSavedRegisters) {
+        rewritten.push_back(new Instruction_assignment(new Variable(callee_save_variable(r)), new Register(r))); 
+      }
+      for (Instruction* i : instructions) {
+        if (dynamic_cast<const Instruction_ret*>(i)) {
+          // call; [:ret;] return, where nothing else jumps to :ret 
+          size_t at = rewritten.size(); 
+          auto *label = dynamic_cast<const Instruction_label*>(rewritten.back()); 
+          size_t callAt = label != nullptr ? at - 2 : at - 1; 
+          bool onlyReturnAddress = label == nullptr || references[label->label()->emit()] <= 1; 
+          auto *call = callAt >= calleeSavedRegisters.size() ? dynamic_cast<const Instruction_call*>(rewritten[callAt]) : nullptr; 
+          if (call != nullptr && call->callType() == CallType::l1 && onlyReturnAddress 
+              && call->callee()->kind() != ItemType::RegisterItem) {
+            at = callAt; 
+          }
+          std::vector<Instruction*> restores; 
+          for (RegisterID r : calleeSavedRegisters) {
+            restores.push_back(new Instruction_assignment(new Register(r), new Variable(callee_save_variable(r)))); 
+          }
+          rewritten.insert(rewritten.begin() + at, restores.begin(), restores.end()); 
+        }
+        rewritten.push_back(i); 
+      }
+      instructions = std::move(rewritten); 
+    }
+  }
+
   void add_edges_to_graph(std::unordered_map<std::string, std::unordered_set<std::string>>& graph, const std::unordered_set<std::string>& A, const std::unordered_set<std::string>&B) {
     for (const auto& v1: A) {
       for (const auto& v2: B) {
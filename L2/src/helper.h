@@ -27,6 +27,17 @@ namespace L2 {
     "rbx", "rbp", "r12", "r13", "r14", "r15"
     };
 
+    // colorOrder lists the caller-saved registers first, then the callee-saved ones
+    inline const size_t callerSavedColors = 9;
+
+    inline const std::vector<RegisterID> calleeSavedRegisters = {rbx, rbp, r12, r13, r14, r15};
+
+    // Rounds of color/spill per function before every variable is spilled outright
+    inline const size_t maxAllocationRounds = 32;
+
+    // Functions longer than this are allocated with linear scan unless -m says otherwise
+    inline const size_t defaultLinearScanAbove = 20000;
+
     AOP aop_from_string(std::string_view s);
     SOP sop_from_string(std::string_view s);
     CMP cmp_from_string(std::string_view s);
@@ -52,4 +63,9 @@ namespace L2 {
     void add_edges_to_graph(std::unordered_map<std::string, std::unordered_set<std::string>>& graph, const std::unordered_set<std::string>& A, const std::unordered_set<std::string>& B);
 
     int comp(int64_t lhs, int64_t rhs, CMP op); 
+
+    CallConvention convention_from_string(std::string_view s); 
+    void drop_return_address_stores(Program& p); 
+    std::string callee_save_variable(RegisterID r); 
+    void save_callee_saved_registers(Program& p); 
 }
@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <utility>
+
+#include <interference_graph.h>
+
+namespace L2 {
+
+    void InterferenceGraph::reset(size_t n) {
+        nodes = n;
+        size_t pairs = n > 1 ? n * (n - 1) / 2 : 0;
+        matrix.assign((pairs + 63) / 64, 0);
+        adjacency.assign(n, {});
+    }
+
+    void InterferenceGraph::resize(size_t n) {
+        if (n <= nodes) return;
+        nodes = n;
+        size_t pairs = n * (n - 1) / 2;
+        matrix.resize((pairs + 63) / 64, 0);
+        adjacency.resize(n);
+    }
+
+    void InterferenceGraph::remove_node(size_t n) {
+        for (uint32_t neigh : adjacency[n]) {
+            size_t bit = bit_index(n, neigh);
+            matrix[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+            auto& list = adjacency[neigh];
+            list.erase(std::find(list.begin(), list.end(), (uint32_t)n));
+        }
+        adjacency[n].clear();
+    }
+
+    size_t InterferenceGraph::bit_index(size_t a, size_t b) const {
+        if (a < b) std::swap(a, b);
+        return a * (a - 1) / 2 + b;
+    }
+
+    void InterferenceGraph::add_edge(size_t a, size_t b) {
+        if (a == b) return;
+        size_t bit = bit_index(a, b);
+        uint64_t mask = (uint64_t)1 << (bit % 64);
+        if (matrix[bit / 64] & mask) return;
+        matrix[bit / 64] |= mask;
+        adjacency[a].push_back(b);
+        adjacency[b].push_back(a);
+    }
+
+    bool InterferenceGraph::interferes(size_t a, size_t b) const {
+        if (a == b) return false;
+        size_t bit = bit_index(a, b);
+        return (matrix[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    const std::vector<uint32_t>& InterferenceGraph::neighbors(size_t n) const {
+        return adjacency[n];
+    }
+
+    size_t InterferenceGraph::degree(size_t n) const {
+        return adjacency[n].size();
+    }
+
+    size_t InterferenceGraph::size() const {
+        return nodes;
+    }
+}
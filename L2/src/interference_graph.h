@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace L2 {
+
+    /*
+     * Chaitin/Briggs-style interference graph over dense node indices.
+     * A lower-triangular bit matrix answers "do a and b interfere" in O(1),
+     * while per-node adjacency vectors keep neighbor iteration compact.
+     */
+    class InterferenceGraph {
+        public:
+            void reset(size_t nodes);
+            // Appending nodes only extends the triangle, so existing edges survive a resize
+            void resize(size_t nodes);
+            void remove_node(size_t n);
+
+            void add_edge(size_t a, size_t b);
+            bool interferes(size_t a, size_t b) const;
+
+            const std::vector<uint32_t>& neighbors(size_t n) const;
+            size_t degree(size_t n) const;
+            size_t size() const;
+
+        private:
+            size_t bit_index(size_t a, size_t b) const;
+
+            size_t nodes = 0;
+            std::vector<uint64_t> matrix;
+            std::vector<std::vector<uint32_t>> adjacency;
+    };
+}
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <iostream>
+
+#include <liveness_analysis.h>
+
+namespace L2{
+
+    /*
+     * Linear-scan allocation for -O0 and for functions too big for graph coloring.
+     * Every instruction j has two program points, 2j before it and 2j+1 after it, so a
+     * move out of a dying register does not count as a conflict. Variables get a single
+     * interval over those points; registers keep the exact points where they are busy.
+     */
+    bool LivenessAnalysisBehavior::linear_scan_function(Program& p) {
+        size_t i = cur_f; 
+        while (allocationRounds[i] < maxAllocationRounds) {
+            allocationRounds[i]++; 
+            clear_function_containers(); 
+            p.functions[i]->accept(*this); 
+            generate_in_out_sets(p); 
+            if (linear_scan(p)) {
+                linearScanned[i] = 1; 
+                return true; 
+            }
+            spilledVariables[i] += spillOutputs[i].size(); 
+            spillRewrites rewrites; 
+            auto remat = rematerializable(p); 
+            std::tie(tempCounters[i], spillCounters[i]) = spill(p, spillOutputs[i], remat, cur_f, tempCounters[i], spillCounters[i], rewrites); 
+        }
+        // Did not settle; graph coloring takes over from the spilled program 
+        return false; 
+    }
+
+    bool LivenessAnalysisBehavior::linear_scan(const Program& p) {
+        auto& functionInstructions = p.functions[cur_f]->instructions; 
+        auto& functionLivenessData = livenessData[cur_f]; 
+        auto& names = nodeNames[cur_f]; 
+        const size_t registers = colorOrder.size(); 
+        const size_t nodes = names.size(); 
+
+        // Intervals for variables, busy points for registers 
+        std::vector<liveInterval> intervals(nodes); 
+        std::vector<std::vector<size_t>> busy(registers); 
+        for (size_t n = 0; n < nodes; n++) {
+            intervals[n] = {n, SIZE_MAX, 0}; 
+        }
+        auto touch = [&](size_t n, size_t point) {
+            if (n < registers) {
+                busy[n].push_back(point); 
+                return; 
+            }
+            intervals[n].start = std::min(intervals[n].start, point); 
+            intervals[n].end = std::max(intervals[n].end, point); 
+        }; 
+        BitVector live(nodes); 
+        for (const auto& block : basicBlocks[cur_f]) {
+            live.assign(block.out); 
+            for (size_t j = block.last + 1; j-- > block.first; ) {
+                const livenessSets& ls = functionLivenessData[j]; 
+                live.for_each([&](size_t n) { touch(n, 2 * j + 1); }); 
+                ls.kill.for_each([&](size_t n) { touch(n, 2 * j + 1); }); 
+                live.assign_transfer(ls.gen, live, ls.kill); 
+                live.for_each([&](size_t n) { touch(n, 2 * j); }); 
+            }
+        }
+        for (auto& points : busy) {
+            std::sort(points.begin(), points.end()); 
+        }
+        auto register_free = [&](size_t r, const liveInterval& iv) {
+            auto it = std::lower_bound(busy[r].begin(), busy[r].end(), iv.start); 
+            return it == busy[r].end() || *it > iv.end; 
+        }; 
+
+        // Shift amounts in a variable can only live in rcx 
+        std::vector<char> rcxOnly(nodes, 0); 
+        size_t rcx = nodeIndex("rcx"); 
+        for (Instruction* inst : functionInstructions) {
+            if (auto *shift = dynamic_cast<const Instruction_sop*>(inst)) {
+                if (shift->src()->kind() == ItemType::VariableItem) {
+                    rcxOnly[nodeIndex(shift->src()->emit())] = 1; 
+                }
+            }
+        }
+
+        // Copies suggest a register: the partner's, if it is free 
+        std::vector<std::vector<size_t>> partners(nodes); 
+        for (const auto& m : moves[cur_f]) {
+            partners[m.dst].push_back(m.src); 
+            partners[m.src].push_back(m.dst); 
+        }
+
+        std::vector<liveInterval> order; 
+        for (size_t n = registers; n < nodes; n++) {
+            if (intervals[n].start != SIZE_MAX) {
+                order.push_back(intervals[n]); 
+            }
+        }
+        std::sort(order.begin(), order.end(), [](const liveInterval& a, const liveInterval& b) {
+            return a.start < b.start || (a.start == b.start && a.node < b.node); 
+        }); 
+
+        auto& colors = nodeColors[cur_f]; 
+        colors.assign(nodes, -1); 
+        for (size_t r = 0; r < registers; r++) {
+            colors[r] = r; 
+        }
+        std::vector<size_t> holder(registers, noNode); 
+        std::vector<liveInterval> active; 
+        auto& spills = spillOutputs[cur_f]; 
+        spills.clear(); 
+
+        for (const auto& iv : order) {
+            // Expire everything that ended before this interval starts 
+            active.erase(std::remove_if(active.begin(), active.end(), [&](const liveInterval& a) {
+                if (a.end >= iv.start) return false; 
+                holder[colors[a.node]] = noNode; 
+                return true; 
+            }), active.end()); 
+
+            auto usable = [&](size_t r) {
+                return register_free(r, iv) && (!rcxOnly[iv.node] || r == rcx); 
+            }; 
+            int chosen = -1; 
+            for (size_t partner : partners[iv.node]) {
+                int r = colors[partner]; 
+                if (r >= 0 && holder[r] == noNode && usable(r)) {
+                    chosen = r; 
+                    break; 
+                }
+            }
+            for (size_t r = 0; r < registers && chosen < 0; r++) {
+                if (holder[r] == noNode && usable(r)) {
+                    chosen = r; 
+                }
+            }
+
+            if (chosen < 0) {
+                // Spill whichever usable holder lives longest, unless this interval does; temps go last 
+                auto isTemp = [&](size_t n) { return names[n].rfind("%S", 0) == 0; }; 
+                size_t victim = iv.node; 
+                for (const auto& a : active) {
+                    if (!usable(colors[a.node])) continue; 
+                    bool better = isTemp(victim) != isTemp(a.node) ? isTemp(victim)
+                                                                    : intervals[a.node].end > intervals[victim].end; 
+                    if (better) victim = a.node; 
+                }
+                spills.insert(names[victim]); 
+                if (victim == iv.node) continue; 
+                chosen = colors[victim]; 
+                colors[victim] = -1; 
+                active.erase(std::find_if(active.begin(), active.end(), [&](const liveInterval& a) {
+                    return a.node == victim; 
+                })); 
+            }
+            colors[iv.node] = chosen; 
+            holder[chosen] = iv.node; 
+            active.push_back(iv); 
+        }
+        if (!spills.empty()) return false; 
+
+        record_colors(); 
+        return true; 
+    }
+}
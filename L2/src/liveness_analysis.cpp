@@ -1,28 +1,39 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <cmath>
+#include <atomic>
+#include <thread>
 
 #include <liveness_analysis.h>
 
 namespace L2{
 
-    LivenessAnalysisBehavior::LivenessAnalysisBehavior(std::ostream &out)
-    : out (out) {
+    LivenessAnalysisBehavior::LivenessAnalysisBehavior(std::ostream &out, bool verbose, size_t jobs, size_t linearScanAbove, bool calleeSavesCopied)
+    : out (out), verbose (verbose), jobs (jobs), linearScanAbove (linearScanAbove), calleeSavesCopied (calleeSavesCopied) {
       return; 
     }
 
     void LivenessAnalysisBehavior::act(Program& p) { 
         initialize_containers(p.functions.size()); 
-        for (int i = 0; i < p.functions.size(); i++) {
-            cur_f = i; 
-            while (true) {
-                clear_function_containers();
-                p.functions[i]->accept(*this);
-                generate_in_out_sets(p);
-                generate_interference_graph(p);
-                if (color_graph()) break;        
-                std::tie(tempCounters[i], spillCounters[i]) = spill(p, spillOutputs[i], cur_f, tempCounters[i], spillCounters[i]);
-            } 
+        if (jobs > 1 && p.functions.size() > 1) {
+            allocate_functions_parallel(p); 
+        } else {
+            for (size_t i = 0; i < p.functions.size(); i++) {
+                allocate_function(p, i); 
+            }
+        }
+        if (verbose) {
+            for (size_t i = 0; i < p.functions.size(); i++) {
+                std::cerr << p.functions[i]->name << ": " << allocationRounds[i] << " allocation rounds" 
+                          << (linearScanned[i] ? " (linear scan), " : ", ") 
+                          << spilledVariables[i] << " spilled variables, " 
+                          << coalescedMoves[i] << " coalesced moves, " 
+                          << calleeSavedVariables[i] << " call-crossing variables in callee-saved registers, " 
+                          << spillOpsAvoided[i] << " spilled uses and defs avoided, " 
+                          << calleeSavedCopies[i] << " callee-saved registers copied out, " 
+                          << deadInstructions[i] << " dead instructions removed\n"; 
+            }
         }
         generate_code(p, colorOutputs, spillCounters); 
 
@@ -32,13 +43,87 @@ namespace L2{
         
     }
 
+    void LivenessAnalysisBehavior::allocate_function(Program& p, size_t i) {
+        cur_f = i; 
+        if (p.functions[i]->instructions.size() > linearScanAbove) {
+            if (linear_scan_function(p)) {
+                share_stack_slots(p); 
+                return; 
+            }
+        }
+        clear_function_containers();
+        p.functions[i]->accept(*this);
+        generate_in_out_sets(p);
+        deadInstructions[i] += eliminate_dead_code(p); 
+        generate_interference_graph(p);
+        while (true) {
+            allocationRounds[i]++; 
+            if (color_graph()) break;        
+            if (allocationRounds[i] >= maxAllocationRounds) {
+                spill_all_variables(); 
+            }
+            spilledVariables[i] += spillOutputs[i].size(); 
+            spillRewrites rewrites; 
+            auto remat = rematerializable(p); 
+            std::tie(tempCounters[i], spillCounters[i]) = spill(p, spillOutputs[i], remat, cur_f, tempCounters[i], spillCounters[i], rewrites);
+            patch_after_spill(p, rewrites); 
+        } 
+        share_stack_slots(p); 
+    }
+
+    /*
+     * Functions only share the program they live in, and spilling rewrites just its own
+     * function's instruction list. Each worker allocates into a private behavior and hands
+     * back the per-function results, so the output matches a serial run.
+     */
+    void LivenessAnalysisBehavior::allocate_functions_parallel(Program& p) {
+        const size_t n = p.functions.size(); 
+        std::atomic<size_t> next(0); 
+        std::vector<std::thread> workers; 
+        for (size_t t = 0; t < std::min(jobs, n); t++) {
+            workers.emplace_back([&]() {
+                LivenessAnalysisBehavior worker(out, false, 1, linearScanAbove, calleeSavesCopied); 
+                worker.initialize_containers(n); 
+                for (size_t i = next++; i < n; i = next++) {
+                    worker.allocate_function(p, i); 
+                    colorOutputs[i] = std::move(worker.colorOutputs[i]); 
+                    tempCounters[i] = worker.tempCounters[i]; 
+                    spillCounters[i] = worker.spillCounters[i]; 
+                    allocationRounds[i] = worker.allocationRounds[i]; 
+                    spilledVariables[i] = worker.spilledVariables[i]; 
+                    coalescedMoves[i] = worker.coalescedMoves[i]; 
+                    calleeSavedVariables[i] = worker.calleeSavedVariables[i]; 
+                    spillOpsAvoided[i] = worker.spillOpsAvoided[i]; 
+                    calleeSavedCopies[i] = worker.calleeSavedCopies[i]; 
+                    linearScanned[i] = worker.linearScanned[i]; 
+                    deadInstructions[i] = worker.deadInstructions[i]; 
+                    worker.clear_function_containers(); 
+                }
+            });
+        }
+        for (auto& w : workers) {
+            w.join(); 
+        }
+    }
+
     void LivenessAnalysisBehavior::act(Function& f) {
         cur_i = 0; 
         livenessData[cur_f].resize(f.instructions.size());
+
+        // Registers always take the first indices so they are stable across functions
+        for (const auto& r : colorOrder) {
+            nodeIndex(r); 
+        }
         for (Instruction *i: f.instructions) {
             i->accept(*this); 
             cur_i++; 
         }
+
+        size_t n = nodeNames[cur_f].size(); 
+        for (auto& ls : livenessData[cur_f]) {
+            ls.gen.resize(n); 
+            ls.kill.resize(n); 
+        }
     }
 
     void LivenessAnalysisBehavior::act(Instruction_assignment& i) {
@@ -53,15 +138,20 @@ namespace L2{
         options.livenessAnalysis = true; 
 
         if (isLivenessContributor(src)) {
-            ls.gen.insert(src->emit(options));
+            ls.gen.set(nodeIndex(src->emit(options)));
         }
         if (isLivenessContributor(dst)) {
             if (dst->kind() == ItemType::MemoryItem) {
-                ls.gen.insert(dst->emit(options)); 
+                ls.gen.set(nodeIndex(dst->emit(options))); 
             } else {
-                ls.kill.insert(dst->emit(options));
+                ls.kill.set(nodeIndex(dst->emit(options)));
             } 
         }
+        // Register/variable copies are coalescing candidates 
+        if (dst->kind() != ItemType::MemoryItem && src->kind() != ItemType::MemoryItem 
+            && isLivenessContributor(dst) && isLivenessContributor(src)) {
+            moves[cur_f].push_back({nodeIndex(dst->emit(options)), nodeIndex(src->emit(options)), cur_i}); 
+        }
     }
 
     void LivenessAnalysisBehavior::act(Instruction_stack_arg_assignment& i) {
@@ -74,7 +164,7 @@ namespace L2{
         options.livenessAnalysis = true; 
 
         if (isLivenessContributor(dst)) {
-            ls.kill.insert(dst->emit(options));
+            ls.kill.set(nodeIndex(dst->emit(options)));
         }
     }
 
@@ -90,11 +180,11 @@ namespace L2{
         options.livenessAnalysis = true; 
 
         if (isLivenessContributor(src)) {
-            ls.gen.insert(src->emit(options));
+            ls.gen.set(nodeIndex(src->emit(options)));
         }
         if (isLivenessContributor(dst)) {
-            ls.gen.insert(dst->emit(options)); 
-            ls.kill.insert(dst->emit(options)); 
+            ls.gen.set(nodeIndex(dst->emit(options))); 
+            ls.kill.set(nodeIndex(dst->emit(options))); 
         }
     }
 
@@ -110,11 +200,11 @@ namespace L2{
         options.livenessAnalysis = true; 
 
         if (isLivenessContributor(src)) {
-            ls.gen.insert(src->emit(options));
+            ls.gen.set(nodeIndex(src->emit(options)));
         }
         if (isLivenessContributor(dst)) {
-            ls.gen.insert(dst->emit(options)); 
-            ls.kill.insert(dst->emit(options));
+            ls.gen.set(nodeIndex(dst->emit(options))); 
+            ls.kill.set(nodeIndex(dst->emit(options)));
         } 
     }
     
@@ -130,13 +220,13 @@ namespace L2{
         options.livenessAnalysis = true; 
 
         if (isLivenessContributor(lhs)) {
-            ls.gen.insert(lhs->emit(options));
+            ls.gen.set(nodeIndex(lhs->emit(options)));
             if (lhs->kind() != ItemType::MemoryItem) {
-                ls.kill.insert(lhs->emit(options)); 
+                ls.kill.set(nodeIndex(lhs->emit(options))); 
             }
         }
         if (isLivenessContributor(rhs)) {
-            ls.gen.insert(rhs->emit(options));
+            ls.gen.set(nodeIndex(rhs->emit(options)));
         }
     }
 
@@ -154,13 +244,13 @@ namespace L2{
         options.livenessAnalysis = true; 
 
         if (isLivenessContributor(dst)) {
-            ls.kill.insert(dst->emit(options));
+            ls.kill.set(nodeIndex(dst->emit(options)));
         } 
         if (isLivenessContributor(lhs)) {
-            ls.gen.insert(lhs->emit(options)); 
+            ls.gen.set(nodeIndex(lhs->emit(options))); 
         }
         if (isLivenessContributor(rhs)) {
-            ls.gen.insert(rhs->emit(options));
+            ls.gen.set(nodeIndex(rhs->emit(options)));
         }
     }
 
@@ -176,10 +266,10 @@ namespace L2{
         options.livenessAnalysis = true; 
 
         if (isLivenessContributor(lhs)) {
-            ls.gen.insert(lhs->emit(options)); 
+            ls.gen.set(nodeIndex(lhs->emit(options))); 
         }
         if (isLivenessContributor(rhs)) {
-            ls.gen.insert(rhs->emit(options));
+            ls.gen.set(nodeIndex(rhs->emit(options)));
         }
     }
 
@@ -197,15 +287,21 @@ namespace L2{
 
     void LivenessAnalysisBehavior::act(Instruction_ret& i) {
         auto &ls = livenessData[cur_f][cur_i];
-        std::unordered_set<std::string> callee_save_registers = {"r12", "r13", "r14", "r15", "rbp", "rbx"}; 
-        ls.gen.insert("rax"); 
-        ls.gen.insert(callee_save_registers.begin(), callee_save_registers.end()); 
+        hasReturn[cur_f] = 1; 
+        std::vector<std::string> callee_save_registers = {"r12", "r13", "r14", "r15", "rbp", "rbx"}; 
+        ls.gen.set(nodeIndex("rax")); 
+        for (const auto& r : callee_save_registers) {
+            ls.gen.set(nodeIndex(r)); 
+        }
     }
 
     void LivenessAnalysisBehavior::act(Instruction_call& i) {
         auto &ls = livenessData[cur_f][cur_i];
-        std::unordered_set<std::string> caller_save_registers = {"r10", "r11", "r8", "r9", "rax", "rcx", "rdi", "rdx", "rsi"}; 
-        ls.kill.insert(caller_save_registers.begin(), caller_save_registers.end());
+        ls.call = true; 
+        std::vector<std::string> caller_save_registers = {"r10", "r11", "r8", "r9", "rax", "rcx", "rdi", "rdx", "rsi"}; 
+        for (const auto& r : caller_save_registers) {
+            ls.kill.set(nodeIndex(r)); 
+        }
 
         std::vector<std::string> argument_registers = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 
@@ -218,13 +314,13 @@ namespace L2{
                 EmitOptions options; 
                 options.livenessAnalysis = true; 
 
-                ls.gen.insert(callee->emit(options));
+                ls.gen.set(nodeIndex(callee->emit(options)));
             }
         }
 
         int64_t num_args = i.nArgs()->value(); 
         for (int argIndex = 0; argIndex < std::min(num_args, static_cast<int64_t>(6)); argIndex++) {
-            ls.gen.insert(argument_registers[argIndex]);
+            ls.gen.set(nodeIndex(argument_registers[argIndex]));
         }
     }
 
@@ -238,8 +334,8 @@ namespace L2{
         options.livenessAnalysis = true; 
 
         if (isLivenessContributor(dst)) {
-            ls.gen.insert(dst->emit(options)); 
-            ls.kill.insert(dst->emit(options));
+            ls.gen.set(nodeIndex(dst->emit(options))); 
+            ls.kill.set(nodeIndex(dst->emit(options)));
         } 
     }
 
@@ -257,26 +353,46 @@ namespace L2{
         options.livenessAnalysis = true; 
 
         if (isLivenessContributor(lhs)) {
-            ls.gen.insert(lhs->emit(options));
+            ls.gen.set(nodeIndex(lhs->emit(options)));
         }
         if (isLivenessContributor(rhs)) {
-            ls.gen.insert(rhs->emit(options));
+            ls.gen.set(nodeIndex(rhs->emit(options)));
         }
         if (isLivenessContributor(dst)) {
-            ls.kill.insert(dst->emit(options));
+            ls.kill.set(nodeIndex(dst->emit(options)));
         }         
     }
 
     void LivenessAnalysisBehavior::initialize_containers(size_t n) {
         tempCounters.resize(n, 0); 
         spillCounters.resize(n, 0); 
+        allocationRounds.resize(n, 0); 
+        spilledVariables.resize(n, 0); 
+        coalescedMoves.resize(n, 0); 
+        hasReturn.resize(n, 0); 
+        calleeSavedVariables.resize(n, 0); 
+        spillOpsAvoided.resize(n, 0); 
+        calleeSavedCopies.resize(n, 0); 
+        linearScanned.resize(n, 0); 
+        deadInstructions.resize(n, 0); 
 
         variables.resize(n); 
+        nodeNames.resize(n); 
+        nodeIndices.resize(n); 
         livenessData.resize(n); 
+        basicBlocks.resize(n); 
+        instructionBlock.resize(n); 
         labelMap.resize(n); 
+        moves.resize(n); 
+        coalescedInto.resize(n); 
         interferenceGraph.resize(n);
         nodeDegrees.resize(n);  
         removed_nodes.resize(n); 
+        spillCosts.resize(n); 
+        retiredNodes.resize(n); 
+        degreeBuckets.resize(n); 
+        spillHeaps.resize(n); 
+        nodeColors.resize(n); 
         node_stack.resize(n); 
         spillOutputs.resize(n); 
         colorOutputs.resize(n);
@@ -284,11 +400,21 @@ namespace L2{
 
     void LivenessAnalysisBehavior::clear_function_containers() {
         variables[cur_f].clear(); 
+        nodeNames[cur_f].clear(); 
+        nodeIndices[cur_f].clear(); 
         livenessData[cur_f].clear();
+        basicBlocks[cur_f].clear(); 
+        instructionBlock[cur_f].clear(); 
         labelMap[cur_f].clear(); 
-        interferenceGraph[cur_f].clear(); 
+        moves[cur_f].clear(); 
+        hasReturn[cur_f] = 0; 
+        coalescedInto[cur_f].clear(); 
+        interferenceGraph[cur_f].reset(0); 
         nodeDegrees[cur_f].clear(); 
         removed_nodes[cur_f].clear(); 
+        spillCosts[cur_f].clear(); 
+        retiredNodes[cur_f].clear(); 
+        nodeColors[cur_f].clear(); 
         node_stack[cur_f].clear(); 
         spillOutputs[cur_f].clear(); 
         colorOutputs[cur_f].clear(); 
@@ -304,6 +430,22 @@ namespace L2{
         return (var->kind() == ItemType::RegisterItem && var->emit() != "%rsp") || var->kind() == ItemType::VariableItem || (var->kind() == ItemType::MemoryItem && var->emit(options) != "rsp");
     }
 
+    bool LivenessAnalysisBehavior::hasSideEffects(const Instruction* i) {
+        // Only register and variable definitions can go; calls, stores and control flow stay 
+        if (auto *a = dynamic_cast<const Instruction_assignment*>(i)) {
+            return a->dst()->kind() == ItemType::MemoryItem; 
+        }
+        if (auto *m = dynamic_cast<const Instruction_mem_aop*>(i)) {
+            return m->lhs()->kind() == ItemType::MemoryItem; 
+        }
+        return !(dynamic_cast<const Instruction_stack_arg_assignment*>(i) 
+            || dynamic_cast<const Instruction_aop*>(i) 
+            || dynamic_cast<const Instruction_sop*>(i) 
+            || dynamic_cast<const Instruction_cmp_assignment*>(i) 
+            || dynamic_cast<const Instruction_reg_inc_dec*>(i) 
+            || dynamic_cast<const Instruction_lea*>(i)); 
+    }
+
     bool LivenessAnalysisBehavior::isNoSuccessorInstruction(const Instruction* i) {
         if (auto *inst = dynamic_cast<const Instruction_call*>(i)) {
             if (inst->callType() == CallType::tuple_error || inst->callType() == CallType::tensor_error) {
@@ -313,11 +455,31 @@ namespace L2{
         return dynamic_cast<const Instruction_ret*>(i);
     }
 
+    size_t LivenessAnalysisBehavior::nodeIndex(const std::string& name) {
+        auto& indices = nodeIndices[cur_f]; 
+        auto it = indices.find(name); 
+        if (it != indices.end()) {
+            return it->second; 
+        }
+        size_t index = nodeNames[cur_f].size(); 
+        indices.emplace(name, index); 
+        nodeNames[cur_f].push_back(name); 
+        return index; 
+    }
+
+    std::unordered_set<std::string> LivenessAnalysisBehavior::names_of(size_t f, const BitVector& bv) {
+        std::unordered_set<std::string> res; 
+        bv.for_each([&](size_t index) {
+            res.insert(nodeNames[f][index]); 
+        });
+        return res; 
+    }
+
 
     void LivenessAnalysisBehavior::print_instruction_gen_kill(size_t cur_i, const livenessSets& ls) {
         std::cout << cur_i << " gen set: ";
         bool first = true;
-        for (const auto &s : ls.gen) {
+        for (const auto &s : names_of(cur_f, ls.gen)) {
             if (!first) std::cout << ", ";
             std::cout << s;
             first = false;
@@ -326,7 +488,7 @@ namespace L2{
 
         std::cout << cur_i << " kill set: ";
         first = true;
-        for (const auto &s : ls.kill) {
+        for (const auto &s : names_of(cur_f, ls.kill)) {
             if (!first) std::cout << ", ";
             std::cout << s;
             first = false;
@@ -347,211 +509,651 @@ namespace L2{
         }
     }
 
-    void LivenessAnalysisBehavior::generate_in_out_sets(const Program &p) {
-        bool change = true; 
-        auto& functionInstructions = p.functions[cur_f]->instructions; 
-        auto& functionLivenessData = livenessData[cur_f]; 
+    size_t LivenessAnalysisBehavior::label_block(const std::string& label) {
         auto& functionLabelMap = labelMap[cur_f]; 
-        int iter = 0; 
-        while (change) {
-            change = false; 
-            for (int j = (int)functionLivenessData.size()-1; j>=0; j--) {
-                livenessSets& ls = functionLivenessData[j];
-                std::unordered_set<std::string> original_in = ls.in; 
-                std::unordered_set<std::string> original_out = ls.out; 
-                Instruction* cur_instruction = functionInstructions[j];
-                if (isNoSuccessorInstruction(cur_instruction)) {
-                    // no successors, out is empty 
-                } else if (auto *gt = dynamic_cast<const Instruction_goto*>(cur_instruction)) {
-                    const std::string label = gt->label()->emit();
-                    auto it = functionLabelMap.find(label);
-                    if (it == functionLabelMap.end()) {
-                    std::cerr << "Unknown label " << label << " in function " << cur_f << "\n";
-                    std::exit(1);
-                    }
-                    size_t label_instruction_index = it->second;
-                    livenessSets& ls_label_instruction = functionLivenessData[label_instruction_index]; 
-                    ls.out = ls_label_instruction.in;
-                } else if (auto *cj = dynamic_cast<const Instruction_cjump*>(cur_instruction)) {
-                    const std::string label = cj->label()->emit();
-                    auto it = functionLabelMap.find(label);
-                    if (it == functionLabelMap.end()) {
-                    std::cerr << "Unknown label " << label << " in function " << cur_f << "\n";
-                    std::exit(1);
-                    }
-                    size_t label_instruction_index = it->second; 
-                    livenessSets& ls_label_instruction = functionLivenessData[label_instruction_index]; 
-                    ls.out = ls_label_instruction.in;
-                    if (j + 1 < (int)functionLivenessData.size()) {
-                        auto& ls_next_inst = functionLivenessData[j+1];
-                        ls.out.insert(ls_next_inst.in.begin(), ls_next_inst.in.end());
-                    }
-                } else {
-                    if (j + 1 < (int)functionLivenessData.size()) {
-                        auto& ls_next_inst = functionLivenessData[j+1];
-                        ls.out = ls_next_inst.in; 
+        auto it = functionLabelMap.find(label);
+        if (it == functionLabelMap.end()) {
+            std::cerr << "Unknown label " << label << " in function " << cur_f << "\n";
+            std::exit(1);
+        }
+        return instructionBlock[cur_f][it->second]; 
+    }
+
+    void LivenessAnalysisBehavior::build_basic_blocks(const Program &p) {
+        auto& functionInstructions = p.functions[cur_f]->instructions; 
+        auto& blocks = basicBlocks[cur_f]; 
+        auto& blockOf = instructionBlock[cur_f]; 
+        size_t n = functionInstructions.size(); 
+        size_t nodes = nodeNames[cur_f].size(); 
+
+        // Leaders: first instruction, every label, and whatever follows a jump or a no-successor instruction
+        blockOf.assign(n, 0); 
+        for (size_t j = 0; j < n; j++) {
+            Instruction* cur_instruction = functionInstructions[j]; 
+            bool leader = j == 0 || dynamic_cast<const Instruction_label*>(cur_instruction); 
+            if (j > 0) {
+                Instruction* prev_instruction = functionInstructions[j-1]; 
+                if (isNoSuccessorInstruction(prev_instruction) 
+                    || dynamic_cast<const Instruction_goto*>(prev_instruction) 
+                    || dynamic_cast<const Instruction_cjump*>(prev_instruction)) {
+                    leader = true; 
+                }
+            }
+            if (leader) {
+                basicBlock b; 
+                b.first = j; 
+                blocks.push_back(std::move(b)); 
+            }
+            blocks.back().last = j; 
+            blockOf[j] = blocks.size() - 1; 
+        }
+
+        for (size_t b = 0; b < blocks.size(); b++) {
+            auto& block = blocks[b]; 
+            Instruction* last_instruction = functionInstructions[block.last]; 
+            if (isNoSuccessorInstruction(last_instruction)) {
+                // no successors, out is empty 
+            } else if (auto *gt = dynamic_cast<const Instruction_goto*>(last_instruction)) {
+                block.successors.push_back(label_block(gt->label()->emit())); 
+            } else if (auto *cj = dynamic_cast<const Instruction_cjump*>(last_instruction)) {
+                block.successors.push_back(label_block(cj->label()->emit())); 
+                if (b + 1 < blocks.size() && b + 1 != block.successors[0]) {
+                    block.successors.push_back(b + 1); 
+                }
+            } else if (b + 1 < blocks.size()) {
+                block.successors.push_back(b + 1); 
+            }
+            for (size_t succ : block.successors) {
+                blocks[succ].predecessors.push_back(b); 
+            }
+
+            block.in.resize(nodes); 
+            block.out.resize(nodes); 
+            block_gen_kill(block); 
+        }
+        compute_loop_depths(); 
+    }
+
+    /*
+     * Natural loops from the back edges of a DFS over the block graph. Loops sharing a
+     * header are merged, and a block's depth is the number of loops that contain it.
+     */
+    void LivenessAnalysisBehavior::compute_loop_depths() {
+        auto& blocks = basicBlocks[cur_f]; 
+        if (blocks.empty()) return; 
+
+        // Iterative DFS; a successor still on the stack closes a back edge 
+        std::vector<char> state(blocks.size(), 0); // 0 unvisited, 1 on stack, 2 done 
+        std::vector<std::pair<size_t, size_t>> stack = {{0, 0}}; 
+        std::vector<std::vector<size_t>> latches(blocks.size()); 
+        state[0] = 1; 
+        while (!stack.empty()) {
+            auto& [b, next] = stack.back(); 
+            if (next == blocks[b].successors.size()) {
+                state[b] = 2; 
+                stack.pop_back(); 
+                continue; 
+            }
+            size_t succ = blocks[b].successors[next++]; 
+            if (state[succ] == 1) {
+                latches[succ].push_back(b); 
+            } else if (state[succ] == 0) {
+                state[succ] = 1; 
+                stack.push_back({succ, 0}); 
+            }
+        }
+
+        std::vector<char> inLoop(blocks.size()); 
+        std::vector<size_t> work; 
+        for (size_t h = 0; h < blocks.size(); h++) {
+            if (latches[h].empty()) continue; 
+            std::fill(inLoop.begin(), inLoop.end(), 0); 
+            inLoop[h] = 1; 
+            for (size_t l : latches[h]) {
+                if (!inLoop[l]) {
+                    inLoop[l] = 1; 
+                    work.push_back(l); 
+                }
+            }
+            while (!work.empty()) {
+                size_t b = work.back(); 
+                work.pop_back(); 
+                for (size_t pred : blocks[b].predecessors) {
+                    if (!inLoop[pred]) {
+                        inLoop[pred] = 1; 
+                        work.push_back(pred); 
                     }
                 }
-                std::unordered_set out_kill_diff_set = set_difference(ls.out, ls.kill);
-                ls.in = set_union(ls.gen, out_kill_diff_set);
-                if (ls.in != original_in || ls.out != original_out) {
-                    change = true;
+            }
+            for (size_t b = 0; b < blocks.size(); b++) {
+                blocks[b].loopDepth += inLoop[b]; 
+            }
+        }
+    }
+
+    void LivenessAnalysisBehavior::block_gen_kill(basicBlock& block) {
+        // Block transfer function, folded backwards over its instructions
+        auto& functionLivenessData = livenessData[cur_f]; 
+        size_t nodes = nodeNames[cur_f].size(); 
+        block.gen.resize(nodes); 
+        block.kill.resize(nodes); 
+        block.gen.clear(); 
+        block.kill.clear(); 
+        for (size_t j = block.last + 1; j-- > block.first; ) {
+            livenessSets& ls = functionLivenessData[j];
+            block.gen.subtract(ls.kill); 
+            block.gen.union_with(ls.gen); 
+            block.kill.union_with(ls.kill); 
+        }
+    }
+
+    void LivenessAnalysisBehavior::generate_in_out_sets(const Program &p) {
+        build_basic_blocks(p); 
+        auto& blocks = basicBlocks[cur_f]; 
+
+        // Seed in reverse order so most blocks see their successors first
+        std::vector<size_t> worklist; 
+        std::vector<char> queued(blocks.size(), 1); 
+        worklist.reserve(blocks.size()); 
+        for (size_t b = 0; b < blocks.size(); b++) {
+            worklist.push_back(b); 
+        }
+
+        while (!worklist.empty()) {
+            size_t b = worklist.back(); 
+            worklist.pop_back(); 
+            queued[b] = 0; 
+
+            auto& block = blocks[b]; 
+            // IN/OUT only ever grow, so OR-ing successors in is the same as reassigning them
+            for (size_t succ : block.successors) {
+                block.out.union_with(blocks[succ].in); 
+            }
+            if (block.in.assign_transfer(block.gen, block.out, block.kill)) {
+                for (size_t pred : block.predecessors) {
+                    if (!queued[pred]) {
+                        queued[pred] = 1; 
+                        worklist.push_back(pred); 
+                    }
                 }
             }
         }
     }
 
+    void LivenessAnalysisBehavior::function_in_out(size_t f, std::vector<BitVector>& ins, std::vector<BitVector>& outs) {
+        ins.assign(livenessData[f].size(), BitVector()); 
+        outs.assign(livenessData[f].size(), BitVector()); 
+        for (size_t b = 0; b < basicBlocks[f].size(); b++) {
+            instruction_in_out(f, b, ins, outs); 
+        }
+    }
+
+    void LivenessAnalysisBehavior::instruction_in_out(size_t f, size_t b, std::vector<BitVector>& ins, std::vector<BitVector>& outs) {
+        const auto& block = basicBlocks[f][b]; 
+        const auto& functionLivenessData = livenessData[f]; 
+        BitVector live = block.out; 
+        for (size_t j = block.last + 1; j-- > block.first; ) {
+            const livenessSets& ls = functionLivenessData[j]; 
+            outs[j] = live; 
+            live.assign_transfer(ls.gen, outs[j], ls.kill); 
+            ins[j] = live; 
+        }
+    }
+
+
 
 
+    size_t LivenessAnalysisBehavior::eliminate_dead_code(Program &p) {
+        // Side-effect-free definitions that are dead on the spot; each sweep walks blocks 
+        // backwards so chains inside a block go at once, then liveness is solved again 
+        auto& functionInstructions = p.functions[cur_f]->instructions; 
+        size_t removed = 0; 
+        while (true) {
+            auto& functionLivenessData = livenessData[cur_f]; 
+            std::vector<char> dead(functionInstructions.size(), 0); 
+            bool sweep = false; 
+            BitVector live(nodeNames[cur_f].size()); 
+            for (const auto& block : basicBlocks[cur_f]) {
+                live.assign(block.out); 
+                for (size_t j = block.last + 1; j-- > block.first; ) {
+                    const livenessSets& ls = functionLivenessData[j]; 
+                    if (!hasSideEffects(functionInstructions[j]) && !ls.kill.empty() && !ls.kill.intersects(live)) {
+                        dead[j] = 1; 
+                        sweep = true; 
+                        continue; 
+                    }
+                    live.assign_transfer(ls.gen, live, ls.kill); 
+                }
+            }
+            if (!sweep) return removed; 
+
+            size_t kept = 0; 
+            for (size_t j = 0; j < functionInstructions.size(); j++) {
+                if (dead[j]) {
+                    delete functionInstructions[j]; 
+                    removed++; 
+                } else {
+                    functionInstructions[kept++] = functionInstructions[j]; 
+                }
+            }
+            functionInstructions.resize(kept); 
+
+            clear_function_containers(); 
+            p.functions[cur_f]->accept(*this); 
+            generate_in_out_sets(p); 
+        }
+    }
 
     void LivenessAnalysisBehavior::generate_interference_graph(const Program &p) {
-        auto& functionInterferenceGraph = interferenceGraph[cur_f];  
+        auto& graph = interferenceGraph[cur_f];  
         auto& functionLivenessData = livenessData[cur_f]; 
         auto& functionInstructions = p.functions[cur_f]->instructions; 
-        for (const auto& v: variables[cur_f]) {
-            functionInterferenceGraph[v];
+        auto& names = nodeNames[cur_f]; 
+        const size_t registers = colorOrder.size(); 
+
+        graph.reset(names.size()); 
+        for (size_t r1 = 0; r1 < registers; r1++) {
+            for (size_t r2 = 0; r2 < r1; r2++) {
+                graph.add_edge(r1, r2); 
+            }
         }
-        add_edges_to_graph(functionInterferenceGraph, GPregisters, GPregisters);
-        for (int j = 0; j<(int)functionLivenessData.size(); j++) {
-            livenessSets& ls = functionLivenessData[j];
-            Instruction* cur_instruction = functionInstructions[j]; 
-            //add_edges_to_graph(functionInterferenceGraph, ls.in, ls.in);
-            //add_edges_to_graph(functionInterferenceGraph, ls.out, ls.out);
-            add_edges_to_graph(functionInterferenceGraph, ls.kill, ls.out); 
-            if (auto *shift = dynamic_cast<const Instruction_sop*>(cur_instruction)) {
-                if (auto* n = dynamic_cast<const Number*>(shift->src())) {
-                    continue;
-                }
+        BitVector out(names.size()); 
+        for (const auto& block : basicBlocks[cur_f]) {
+            out.assign(block.out); 
+            for (size_t j = block.last + 1; j-- > block.first; ) {
+                livenessSets& ls = functionLivenessData[j];
+                add_instruction_edges(functionInstructions[j], ls, out); 
+                // OUT of the previous instruction is IN of this one 
+                out.assign_transfer(ls.gen, out, ls.kill); 
+            }
+        }
+        retiredNodes[cur_f].assign(names.size(), 0); 
+        initialize_node_degrees(); 
+    }
+
+    void LivenessAnalysisBehavior::add_instruction_edges(Instruction* i, const livenessSets& ls, const BitVector& out) {
+        auto& graph = interferenceGraph[cur_f];  
+        ls.kill.for_each([&](size_t k) {
+            out.for_each([&](size_t o) {
+                graph.add_edge(k, o); 
+            });
+        });
+        if (auto *shift = dynamic_cast<const Instruction_sop*>(i)) {
+            if (!dynamic_cast<const Number*>(shift->src())) {
                 EmitOptions options; 
                 options.livenessAnalysis = true; 
-                std::unordered_set<std::string> rcxVar = {shift->src()->emit(options)};
-                add_edges_to_graph(functionInterferenceGraph, rcxVar, GPregisters_without_rcx); 
+                size_t rcxVar = nodeIndex(shift->src()->emit(options)); 
+                size_t rcx = nodeIndex("rcx"); 
+                for (size_t r = 0; r < colorOrder.size(); r++) {
+                    if (r != rcx) graph.add_edge(rcxVar, r); 
+                }
             }
         }
-        for (const auto& [key, val] : functionInterferenceGraph) {
-            nodeDegrees[cur_f][key] = val.size(); 
+    }
+
+    void LivenessAnalysisBehavior::initialize_node_degrees() {
+        auto& graph = interferenceGraph[cur_f];  
+        auto& degrees = nodeDegrees[cur_f]; 
+        size_t nodes = nodeNames[cur_f].size(); 
+        degrees.resize(nodes); 
+        for (size_t n = 0; n < nodes; n++) {
+            degrees[n] = graph.degree(n); 
         }
+        removed_nodes[cur_f].assign(nodes, 0); 
+        node_stack[cur_f].clear(); 
+        colorOutputs[cur_f].clear(); 
     }
-        
 
-    std::string LivenessAnalysisBehavior::pick_low_node() {
-        size_t best = 0; 
-        std::string bestNode; 
-        bool found = false; 
-        for (const auto& [key, val] : nodeDegrees[cur_f]) {
-            if (key[0] == '%' && !removed_nodes[cur_f].count(key) && val < 15) {
-                if (val > best || !found) {
-                    found = true; 
-                    best = val; 
-                    bestNode = key; 
-                }
+    /*
+     * Spill temps never live across a basic block boundary, so block IN/OUT is the old
+     * liveness minus the spilled variables. Only the rewritten instructions need fresh
+     * gen/kill sets, and only the blocks holding them need their edges walked again.
+     */
+    void LivenessAnalysisBehavior::patch_after_spill(const Program &p, const spillRewrites &rewrites) {
+        auto& functionInstructions = p.functions[cur_f]->instructions; 
+        auto& functionLivenessData = livenessData[cur_f]; 
+        auto& graph = interferenceGraph[cur_f]; 
+        auto& blocks = basicBlocks[cur_f]; 
+        auto& blockOf = instructionBlock[cur_f]; 
+        const auto& starts = rewrites.starts; 
+
+        // Spilled variables leave the function for good
+        BitVector spilled(nodeNames[cur_f].size()); 
+        for (const auto& v : spillOutputs[cur_f]) {
+            size_t n = nodeIndex(v); 
+            spilled.set(n); 
+            retiredNodes[cur_f][n] = 1; 
+            variables[cur_f].erase(v); 
+            graph.remove_node(n); 
+        }
+        spillOutputs[cur_f].clear(); 
+        std::vector<char> blockTouched(blocks.size(), 0); 
+        std::vector<char> replaced(functionLivenessData.size(), 0); 
+        for (size_t j : rewrites.replaced) {
+            blockTouched[blockOf[j]] = 1; 
+            replaced[j] = 1; 
+        }
+
+        // Replaced instructions record their moves again when they are re-accepted below
+        auto& functionMoves = moves[cur_f]; 
+        functionMoves.erase(std::remove_if(functionMoves.begin(), functionMoves.end(), [&](const moveCandidate& m) {
+            return spilled.test(m.dst) || spilled.test(m.src) || replaced[m.instruction]; 
+        }), functionMoves.end()); 
+        for (auto& m : functionMoves) {
+            m.instruction = starts[m.instruction]; 
+        }
+
+        // Untouched instructions keep their sets at their new position
+        std::vector<livenessSets> newData(functionInstructions.size()); 
+        std::vector<char> touched(functionInstructions.size(), 0); 
+        for (size_t j = 0; j < functionLivenessData.size(); j++) {
+            newData[starts[j]] = std::move(functionLivenessData[j]); 
+        }
+        for (size_t j : rewrites.replaced) {
+            for (size_t k = starts[j]; k < starts[j+1]; k++) {
+                newData[k] = livenessSets(); 
+                touched[k] = 1; 
+            }
+        }
+        functionLivenessData = std::move(newData); 
+        for (auto& [label, index] : labelMap[cur_f]) {
+            index = starts[index]; 
+        }
+        for (size_t k = 0; k < functionInstructions.size(); k++) {
+            if (touched[k]) {
+                cur_i = k; 
+                functionInstructions[k]->accept(*this); 
+            }
+        }
+
+        size_t nodes = nodeNames[cur_f].size(); 
+        for (auto& ls : functionLivenessData) {
+            ls.gen.resize(nodes); 
+            ls.kill.resize(nodes); 
+        }
+        spilled.resize(nodes); 
+        retiredNodes[cur_f].resize(nodes, 0); 
+        graph.resize(nodes); 
+
+        blockOf.assign(functionInstructions.size(), 0); 
+        BitVector out(nodes); 
+        for (size_t b = 0; b < blocks.size(); b++) {
+            auto& block = blocks[b]; 
+            block.first = starts[block.first]; 
+            block.last = starts[block.last + 1] - 1; 
+            for (size_t k = block.first; k < block.last + 1; k++) {
+                blockOf[k] = b; 
+            }
+            block.in.resize(nodes); 
+            block.out.resize(nodes); 
+            block.in.subtract(spilled); 
+            block.out.subtract(spilled); 
+            if (!blockTouched[b]) {
+                block.gen.resize(nodes); 
+                block.kill.resize(nodes); 
+                continue; 
+            }
+            block_gen_kill(block); 
+
+            out.assign(block.out); 
+            for (size_t k = block.last + 1; k-- > block.first; ) {
+                livenessSets& ls = functionLivenessData[k];
+                add_instruction_edges(functionInstructions[k], ls, out); 
+                out.assign_transfer(ls.gen, out, ls.kill); 
             }
         }
-        return bestNode; 
+
+        initialize_node_degrees(); 
     }
+        
 
-    std::string LivenessAnalysisBehavior::pick_high_node() {
-        size_t best = 0; 
-        std::string bestNode; 
-        bool found = false; 
-        for (const auto& [key, val] : nodeDegrees[cur_f]) {
-            if (key[0] == '%' && !removed_nodes[cur_f].count(key)) {
-                if (val > best || !found) {
-                    found = true; 
-                    best = val; 
-                    bestNode = key; 
-                }
+    void LivenessAnalysisBehavior::compute_spill_costs() {
+        // Uses and defs weighted by 10^loop depth; spill temps are never worth spilling again 
+        auto& costs = spillCosts[cur_f]; 
+        auto& names = nodeNames[cur_f]; 
+        auto& functionLivenessData = livenessData[cur_f]; 
+        costs.assign(names.size(), 0.0); 
+        for (const auto& block : basicBlocks[cur_f]) {
+            double weight = std::pow(10.0, (double)block.loopDepth); 
+            for (size_t j = block.first; j < block.last + 1; j++) {
+                const livenessSets& ls = functionLivenessData[j]; 
+                ls.gen.for_each([&](size_t n) { costs[n] += weight; }); 
+                ls.kill.for_each([&](size_t n) { costs[n] += weight; }); 
+            }
+        }
+        for (size_t n = colorOrder.size(); n < names.size(); n++) {
+            if (names[n].rfind("%S", 0) == 0) {
+                costs[n] = HUGE_VAL; 
             }
         }
-        return bestNode; 
     }
 
-    void LivenessAnalysisBehavior::update_graph(const std::string &selected) {
-        removed_nodes[cur_f].insert(selected); 
-        auto it = interferenceGraph[cur_f].find(selected); 
-        if (it == interferenceGraph[cur_f].end()) return; 
-        for (const auto& neigh : it -> second) {
-            if (removed_nodes[cur_f].count(neigh)) { continue ;} 
+    // Highest-degree variable that is still trivially colorable
+    size_t LivenessAnalysisBehavior::pick_low_node() {
+        size_t node = degreeBuckets[cur_f].pick_max(colorOrder.size() - 1); 
+        return node == DegreeBuckets::none ? noNode : node; 
+    }
+
+    size_t LivenessAnalysisBehavior::pick_high_node() {
+        // Cheapest node to spill: lowest cost per interfering neighbor 
+        size_t node = spillHeaps[cur_f].top(); 
+        return node == SpillHeap::none ? noNode : node; 
+    }
+
+    void LivenessAnalysisBehavior::update_graph(size_t selected) {
+        auto& removed = removed_nodes[cur_f]; 
+        auto& buckets = degreeBuckets[cur_f]; 
+        auto& heap = spillHeaps[cur_f]; 
+        removed[selected] = 1; 
+        buckets.remove(selected); 
+        heap.remove(selected); 
+        for (uint32_t neigh : interferenceGraph[cur_f].neighbors(selected)) {
+            if (removed[neigh]) { continue ;} 
             auto& d = nodeDegrees[cur_f][neigh]; 
             if (d > 0) d--; 
+            if (buckets.contains(neigh)) {
+                buckets.move(neigh, d); 
+            }
+            if (heap.contains(neigh)) {
+                // Dropping below K makes it trivially colorable, no longer a spill candidate 
+                if (d < colorOrder.size()) {
+                    heap.remove(neigh); 
+                } else {
+                    heap.update(neigh, spillCosts[cur_f][neigh], d); 
+                }
+            }
         }
     }
 
     void LivenessAnalysisBehavior::select_nodes() {
-        auto& functionNodeDegrees = nodeDegrees[cur_f]; 
+        // Only variables are bucketed; registers are precolored and never simplified
+        auto& buckets = degreeBuckets[cur_f]; 
+        auto& degrees = nodeDegrees[cur_f]; 
+        auto& heap = spillHeaps[cur_f]; 
+        buckets.reset(degrees.size()); 
+        heap.reset(degrees.size()); 
+        compute_spill_costs(); 
+        for (size_t n = colorOrder.size(); n < degrees.size(); n++) {
+            if (!retiredNodes[cur_f][n] && coalescedInto[cur_f][n] == noNode) {
+                buckets.insert(n, degrees[n]); 
+                if (degrees[n] >= colorOrder.size()) {
+                    heap.update(n, spillCosts[cur_f][n], degrees[n]); 
+                }
+            }
+        }
+
         bool hasPick = true; 
         while (hasPick) {
-            std::string selected; 
-            std::string low_node = pick_low_node();
-            if (low_node.empty()) {
-                std::string high_node = pick_high_node();
-                if (high_node.empty()) {
-                    hasPick = false; 
-                } else {
-                    selected = high_node; 
-                    node_stack[cur_f].push_back(high_node); 
-                }
-            } else {
-                selected = low_node; 
-                node_stack[cur_f].push_back(low_node); 
+            size_t selected = pick_low_node();
+            if (selected == noNode) {
+                selected = pick_high_node();
             }
-            if (!selected.empty()) {
+            if (selected == noNode) {
+                hasPick = false; 
+            } else {
+                node_stack[cur_f].push_back(selected); 
                 update_graph(selected); 
             }
         }
     } 
 
-    bool LivenessAnalysisBehavior::color_or_spill_node(const std::string &cur_node, const std::unordered_set<std::string> &neighbors) {
-        for (const auto& color : colorOrder) {
-            bool found = true; 
-            for (const auto& neigh : neighbors) {
-                if (color == neigh || (colorOutputs[cur_f].count(neigh) && color == colorOutputs[cur_f].at(neigh))) {
-                    found = false; 
-                    break; 
-                }
+    bool LivenessAnalysisBehavior::color_or_spill_node(size_t cur_node) {
+        auto& colors = nodeColors[cur_f]; 
+        uint32_t taken = 0; 
+        for (uint32_t neigh : interferenceGraph[cur_f].neighbors(cur_node)) {
+            if (colors[neigh] >= 0) {
+                taken |= (uint32_t)1 << colors[neigh]; 
             }
-            if (found) {
-                colorOutputs[cur_f][cur_node] = color;
+        }
+        for (size_t color = 0; color < colorOrder.size(); color++) {
+            if (!(taken & ((uint32_t)1 << color))) {
+                colors[cur_node] = color;
                 return false; 
             }
         }
         return true; 
     }
+
+    size_t LivenessAnalysisBehavior::alias_of(size_t n) {
+        auto& alias = coalescedInto[cur_f]; 
+        while (alias[n] != noNode) {
+            n = alias[n]; 
+        }
+        return n; 
+    }
+
+    bool LivenessAnalysisBehavior::briggs_safe(size_t a, size_t b) {
+        // Merged node has fewer than K neighbors of significant degree 
+        auto& graph = interferenceGraph[cur_f]; 
+        const size_t k = colorOrder.size(); 
+        size_t significant = 0; 
+        for (uint32_t t : graph.neighbors(a)) {
+            if (graph.degree(t) >= k) significant++; 
+        }
+        for (uint32_t t : graph.neighbors(b)) {
+            if (!graph.interferes(a, t) && graph.degree(t) >= k) significant++; 
+        }
+        return significant < k; 
+    }
+
+    bool LivenessAnalysisBehavior::george_safe(size_t reg, size_t var) {
+        // Every neighbor of var already interferes with reg or is trivially colorable 
+        auto& graph = interferenceGraph[cur_f]; 
+        for (uint32_t t : graph.neighbors(var)) {
+            if (!graph.interferes(reg, t) && graph.degree(t) >= colorOrder.size()) return false; 
+        }
+        return true; 
+    }
+
+    /*
+     * Conservative coalescing. A variable copied to or from a register is folded into the
+     * register when George's test holds, two variables when Briggs' test holds. Folding
+     * only changes the working graph of this round; the caller keeps the original.
+     */
+    bool LivenessAnalysisBehavior::coalesce_moves(InterferenceGraph& original) {
+        auto& graph = interferenceGraph[cur_f]; 
+        auto& alias = coalescedInto[cur_f]; 
+        const size_t registers = colorOrder.size(); 
+        alias.assign(nodeNames[cur_f].size(), noNode); 
+        coalescedMoves[cur_f] = 0; 
+        bool merged = false; 
+        for (const auto& m : moves[cur_f]) {
+            size_t a = alias_of(m.dst); 
+            size_t b = alias_of(m.src); 
+            if (a == b) {
+                coalescedMoves[cur_f]++; 
+                continue; 
+            }
+            if (b < registers) std::swap(a, b); 
+            if (b < registers || graph.interferes(a, b)) continue; 
+            if (!(a < registers ? george_safe(a, b) : briggs_safe(a, b))) continue; 
+
+            if (!merged) {
+                original = graph; 
+                merged = true; 
+            }
+            std::vector<uint32_t> neighbors = graph.neighbors(b); 
+            for (uint32_t t : neighbors) {
+                graph.add_edge(a, t); 
+            }
+            graph.remove_node(b); 
+            alias[b] = a; 
+            coalescedMoves[cur_f]++; 
+        }
+        if (merged) {
+            auto& degrees = nodeDegrees[cur_f]; 
+            for (size_t n = 0; n < degrees.size(); n++) {
+                degrees[n] = graph.degree(n); 
+            }
+        }
+        return merged; 
+    }
+
     bool LivenessAnalysisBehavior::color_graph() {
+        InterferenceGraph original; 
+        bool merged = coalesce_moves(original); 
         select_nodes();
 
         auto& stack = node_stack[cur_f];
-        auto& graph = interferenceGraph[cur_f];
+        auto& names = nodeNames[cur_f]; 
+
+        // Registers are precolored with their own slot in colorOrder
+        auto& colors = nodeColors[cur_f]; 
+        colors.assign(names.size(), -1); 
+        for (size_t r = 0; r < colorOrder.size(); r++) {
+            colors[r] = r; 
+        }
 
-        std::string spillCandidate = "";
+        std::vector<size_t> spilledNodes; 
+        bool spilledNonTemp = false; 
 
         while (!stack.empty()) {
-            std::string node = stack.back();
+            size_t node = stack.back();
             stack.pop_back();
 
-            bool spilled = color_or_spill_node(node, graph[node]); // Empty: Take, otherwise prioritize non temp, otherwise prioritize highest neighbors
+            bool spilled = color_or_spill_node(node); 
             if (spilled) {
-                if (spillCandidate.empty() 
-                    ||
-                    (spillCandidate.rfind("%S", 0) == 0 &&
-                    node.rfind("%S", 0) != 0) 
-                    ||
-                    (nodeDegrees[cur_f][node] > nodeDegrees[cur_f][spillCandidate])) {
-                    spillCandidate = node;
-                }
+                spilledNodes.push_back(node); 
+                spilledNonTemp |= names[node].rfind("%S", 0) != 0; 
+            }
+        }
+
+        // Coalesced nodes take their representative's color, or spill along with it 
+        for (size_t n = colorOrder.size(); n < names.size(); n++) {
+            if (coalescedInto[cur_f][n] == noNode) continue; 
+            colors[n] = colors[alias_of(n)]; 
+            if (colors[n] < 0) {
+                spilledNodes.push_back(n); 
+                spilledNonTemp |= names[n].rfind("%S", 0) != 0; 
             }
         }
+        if (merged) {
+            interferenceGraph[cur_f] = std::move(original); 
+        }
 
-        if (!spillCandidate.empty()) {
+        // Spill every actual spill this round; temps are only respilled when nothing else is left 
+        if (!spilledNodes.empty()) {
             spillOutputs[cur_f].clear();
-            spillOutputs[cur_f].insert(spillCandidate);
+            for (size_t node : spilledNodes) {
+                if (!spilledNonTemp || names[node].rfind("%S", 0) != 0) {
+                    spillOutputs[cur_f].insert(names[node]);
+                }
+            }
             return false;
         }
 
-        if (colorOutputs[cur_f].size() != variables[cur_f].size()) { // Couldn't spill but couldn't color everything, spill everything
+        record_colors(); 
+
+        if (colorOutputs[cur_f].size() != variables[cur_f].size()) { // Couldn't spill but couldn't color everything, spill the cheapest
+            size_t cheapest = noNode; 
             for (const auto& v : variables[cur_f]) {
-                spillOutputs[cur_f].insert(v);
-                break; 
+                size_t n = nodeIndex(v); 
+                if (cheapest == noNode || spillCosts[cur_f][n] < spillCosts[cur_f][cheapest]) {
+                    cheapest = n; 
+                }
+            }
+            if (cheapest != noNode) {
+                spillOutputs[cur_f].insert(names[cheapest]);
             }
             return false;
         }
@@ -561,12 +1163,251 @@ namespace L2{
 
 
 
+    void LivenessAnalysisBehavior::record_colors() {
+        // Shared by graph coloring and linear scan: colored variables get their register name 
+        auto& colors = nodeColors[cur_f]; 
+        auto& names = nodeNames[cur_f]; 
+        colorOutputs[cur_f].clear(); 
+        for (size_t n = colorOrder.size(); n < names.size(); n++) {
+            if (colors[n] >= 0) {
+                colorOutputs[cur_f][names[n]] = colorOrder[colors[n]]; 
+            }
+        }
+        count_callee_saved_homes(); 
+    }
+
+    /*
+     * Without the copies from save_callee_saved_registers, a variable live across a call 
+     * in a function that returns interfered with every register and was spilled: a reload 
+     * for each use and a store for each def. Counts those now held in a callee-saved 
+     * register, and the registers whose copy did not coalesce away and so cost a save 
+     * on entry and a restore at each return. 
+     */
+    void LivenessAnalysisBehavior::count_callee_saved_homes() {
+        calleeSavedVariables[cur_f] = 0; 
+        spillOpsAvoided[cur_f] = 0; 
+        calleeSavedCopies[cur_f] = 0; 
+        if (!calleeSavesCopied || !hasReturn[cur_f]) return; 
+
+        auto& colors = nodeColors[cur_f]; 
+        auto& names = nodeNames[cur_f]; 
+        auto& functionLivenessData = livenessData[cur_f]; 
+        std::vector<char> crosses(names.size(), 0); 
+        std::vector<size_t> references(names.size(), 0); 
+        BitVector live(names.size()); 
+        for (const auto& block : basicBlocks[cur_f]) {
+            live.assign(block.out); 
+            for (size_t j = block.last + 1; j-- > block.first; ) {
+                const livenessSets& ls = functionLivenessData[j]; 
+                if (ls.call) {
+                    live.for_each([&](size_t n) { crosses[n] = 1; }); 
+                }
+                ls.gen.for_each([&](size_t n) { references[n]++; }); 
+                ls.kill.for_each([&](size_t n) { references[n]++; }); 
+                live.assign_transfer(ls.gen, live, ls.kill); 
+            }
+        }
+        for (size_t n = colorOrder.size(); n < names.size(); n++) {
+            if (colors[n] >= (int)callerSavedColors && crosses[n] && names[n].rfind("%callee-", 0) != 0) {
+                calleeSavedVariables[cur_f]++; 
+                spillOpsAvoided[cur_f] += references[n]; 
+            }
+        }
+        for (RegisterID r : calleeSavedRegisters) {
+            auto it = colorOutputs[cur_f].find(callee_save_variable(r)); 
+            if (it == colorOutputs[cur_f].end() || it->second != string_from_register(r)) {
+                calleeSavedCopies[cur_f]++; 
+            }
+        }
+    }
+
+    void LivenessAnalysisBehavior::spill_all_variables() {
+        // Out of rounds: spill every original variable so only short-lived temps are left to color 
+        std::unordered_set<std::string> all; 
+        for (const auto& v : variables[cur_f]) {
+            if (v.rfind("%S", 0) != 0) {
+                all.insert(v); 
+            }
+        }
+        if (!all.empty()) {
+            spillOutputs[cur_f] = std::move(all); 
+        }
+    }
+
+
+
+    std::unordered_map<std::string, Item*> LivenessAnalysisBehavior::rematerializable(const Program &p) {
+        // Spilled variables defined exactly once, by a constant, label or function name 
+        auto& functionInstructions = p.functions[cur_f]->instructions; 
+        auto& functionLivenessData = livenessData[cur_f]; 
+        std::vector<size_t> defs(nodeNames[cur_f].size(), 0); 
+        std::vector<size_t> lastDef(nodeNames[cur_f].size(), 0); 
+        for (size_t j = 0; j < functionLivenessData.size(); j++) {
+            functionLivenessData[j].kill.for_each([&](size_t n) {
+                defs[n]++; 
+                lastDef[n] = j; 
+            });
+        }
+        std::unordered_map<std::string, Item*> remat; 
+        for (const auto& v : spillOutputs[cur_f]) {
+            size_t n = nodeIndex(v); 
+            if (defs[n] != 1) continue; 
+            auto *a = dynamic_cast<Instruction_assignment*>(functionInstructions[lastDef[n]]); 
+            if (!a) continue; 
+            ItemType k = a->src()->kind(); 
+            if (k == ItemType::NumberItem || k == ItemType::LabelItem || k == ItemType::FuncItem) {
+                remat[v] = a->src(); 
+            }
+        }
+        return remat; 
+    }
+
+
+
+    size_t LivenessAnalysisBehavior::stack_slot(const Item* item) {
+        // Spill slots are the mem rsp 0 .. 8*(spills-1) accesses SpillBehavior emits 
+        if (item->kind() != ItemType::MemoryItem) return noNode; 
+        auto *m = dynamic_cast<const Memory*>(item); 
+        if (m->getVar()->emit() != "%rsp") return noNode; 
+        int64_t offset = m->getOffset()->value(); 
+        if (offset < 0 || offset % 8 != 0 || offset / 8 >= (int64_t)spillCounters[cur_f]) return noNode; 
+        return offset / 8; 
+    }
+
+    /*
+     * Spill slots are live from a load back to the stores that reach it, exactly like
+     * variables. Slots that are never live together are colored into the same frame slot,
+     * and the frame shrinks to the number of colors.
+     */
+    void LivenessAnalysisBehavior::share_stack_slots(Program &p) {
+        auto& functionInstructions = p.functions[cur_f]->instructions; 
+        auto& blocks = basicBlocks[cur_f]; 
+        const size_t slots = spillCounters[cur_f]; 
+        if (slots < 2) return; 
+
+        // Loads gen a slot, stores kill it 
+        std::vector<livenessSets> access(functionInstructions.size()); 
+        for (size_t j = 0; j < functionInstructions.size(); j++) {
+            auto& a = access[j]; 
+            a.gen.resize(slots); 
+            a.kill.resize(slots); 
+            Instruction* i = functionInstructions[j]; 
+            if (auto *as = dynamic_cast<const Instruction_assignment*>(i)) {
+                size_t load = stack_slot(as->src()); 
+                size_t store = stack_slot(as->dst()); 
+                if (load != noNode) a.gen.set(load); 
+                if (store != noNode) a.kill.set(store); 
+            } else if (auto *ma = dynamic_cast<const Instruction_mem_aop*>(i)) {
+                for (const Item* item : {ma->lhs(), ma->rhs()}) {
+                    size_t slot = stack_slot(item); 
+                    if (slot != noNode) a.gen.set(slot); 
+                }
+            }
+        }
+
+        std::vector<livenessSets> blockAccess(blocks.size()); 
+        std::vector<BitVector> in(blocks.size(), BitVector(slots)); 
+        std::vector<BitVector> out(blocks.size(), BitVector(slots)); 
+        for (size_t b = 0; b < blocks.size(); b++) {
+            auto& ba = blockAccess[b]; 
+            ba.gen.resize(slots); 
+            ba.kill.resize(slots); 
+            for (size_t j = blocks[b].last + 1; j-- > blocks[b].first; ) {
+                ba.gen.subtract(access[j].kill); 
+                ba.gen.union_with(access[j].gen); 
+                ba.kill.union_with(access[j].kill); 
+            }
+        }
+        std::vector<size_t> worklist; 
+        std::vector<char> queued(blocks.size(), 1); 
+        for (size_t b = 0; b < blocks.size(); b++) {
+            worklist.push_back(b); 
+        }
+        while (!worklist.empty()) {
+            size_t b = worklist.back(); 
+            worklist.pop_back(); 
+            queued[b] = 0; 
+            for (size_t succ : blocks[b].successors) {
+                out[b].union_with(in[succ]); 
+            }
+            if (in[b].assign_transfer(blockAccess[b].gen, out[b], blockAccess[b].kill)) {
+                for (size_t pred : blocks[b].predecessors) {
+                    if (!queued[pred]) {
+                        queued[pred] = 1; 
+                        worklist.push_back(pred); 
+                    }
+                }
+            }
+        }
+
+        InterferenceGraph slotGraph; 
+        slotGraph.reset(slots); 
+        BitVector live(slots); 
+        for (size_t b = 0; b < blocks.size(); b++) {
+            live.assign(out[b]); 
+            for (size_t j = blocks[b].last + 1; j-- > blocks[b].first; ) {
+                access[j].kill.for_each([&](size_t k) {
+                    live.for_each([&](size_t o) {
+                        slotGraph.add_edge(k, o); 
+                    });
+                });
+                live.assign_transfer(access[j].gen, live, access[j].kill); 
+            }
+        }
+
+        // First-fit in slot order 
+        std::vector<size_t> slotColor(slots); 
+        std::vector<char> taken; 
+        size_t frame = 0; 
+        for (size_t s = 0; s < slots; s++) {
+            taken.assign(frame + 1, 0); 
+            for (uint32_t neigh : slotGraph.neighbors(s)) {
+                if (neigh < s) taken[slotColor[neigh]] = 1; 
+            }
+            size_t color = 0; 
+            while (taken[color]) color++; 
+            slotColor[s] = color; 
+            frame = std::max(frame, color + 1); 
+        }
+        if (frame == slots) return; 
+
+        auto relocate = [&](Item* item) -> Item* {
+            size_t slot = stack_slot(item); 
+            if (slot == noNode || slotColor[slot] == slot) return item; 
+            auto *m = dynamic_cast<Memory*>(item); 
+            return new Memory(m->getVar(), new Number(slotColor[slot] * 8)); 
+        };
+        for (auto& i : functionInstructions) {
+            if (auto *as = dynamic_cast<Instruction_assignment*>(i)) {
+                Item* dst = relocate(as->dst()); 
+                Item* src = relocate(as->src()); 
+                if (dst != as->dst() || src != as->src()) {
+                    delete i; 
+                    i = new Instruction_assignment(dst, src); 
+                }
+            } else if (auto *ma = dynamic_cast<Instruction_mem_aop*>(i)) {
+                Item* lhs = relocate(ma->lhs()); 
+                Item* rhs = relocate(ma->rhs()); 
+                if (lhs != ma->lhs() || rhs != ma->rhs()) {
+                    AOP aop = ma->aop(); 
+                    delete i; 
+                    i = new Instruction_mem_aop(lhs, aop, rhs); 
+                }
+            }
+        }
+        spillCounters[cur_f] = frame; 
+    }
+
+
+
     void LivenessAnalysisBehavior::print_in_out_sets() {
         for (size_t f = 0; f < livenessData.size(); ++f) {
             std::cout << "Function " << f << ":\n";
 
+            std::vector<BitVector> ins, outs; 
+            function_in_out(f, ins, outs); 
+
             for (size_t i = 0; i < livenessData[f].size(); ++i) {
-            const auto& ls = livenessData[f][i];
 
             auto printSet = [](const std::unordered_set<std::string>& s) {
                 bool first = true;
@@ -580,11 +1421,11 @@ namespace L2{
             std::cout << "  Instr " << i << "\n";
 
             std::cout << "    IN  : { ";
-            printSet(ls.in);
+            printSet(names_of(f, ins[i]));
             std::cout << " }\n";
 
             std::cout << "    OUT : { ";
-            printSet(ls.out);
+            printSet(names_of(f, outs[i]));
             std::cout << " }\n";
             }
         }
@@ -611,18 +1452,21 @@ namespace L2{
     void LivenessAnalysisBehavior::print_liveness_tests() {
         const size_t f = 0;
 
+        std::vector<BitVector> ins, outs; 
+        function_in_out(f, ins, outs); 
+
         out << "(\n";
 
         out << "(in\n";
         for (size_t i = 0; i < livenessData[f].size(); ++i) {
-            print_paren_set(livenessData[f][i].in);
+            print_paren_set(names_of(f, ins[i]));
         }
 
         out << ")\n\n";
 
         out << "(out\n";
         for (size_t i = 0; i < livenessData[f].size(); ++i) {
-            print_paren_set(livenessData[f][i].out);
+            print_paren_set(names_of(f, outs[i]));
         }
 
         out << ")\n\n";
@@ -632,13 +1476,16 @@ namespace L2{
 
     void LivenessAnalysisBehavior::print_interference_tests() {
         const size_t f = 0; 
-        std::vector<std::string> keys; 
-        std::transform(interferenceGraph[f].begin(), interferenceGraph[f].end(), std::back_inserter(keys), [](const auto& m) {return m.first;});
-        std::sort(keys.begin(), keys.end()); 
-        for (auto& key: keys) {
+        auto& names = nodeNames[f]; 
+        std::vector<size_t> keys(names.size()); 
+        for (size_t n = 0; n < keys.size(); n++) keys[n] = n; 
+        std::sort(keys.begin(), keys.end(), [&](size_t a, size_t b) {return names[a] < names[b];}); 
+        for (size_t node : keys) {
+            if (retiredNodes[f][node]) continue; 
+            const std::string& key = names[node]; 
             std::vector<std::string> keyConnects; 
-            auto& neighSet = interferenceGraph[f].at(key); 
-            std::transform(neighSet.begin(), neighSet.end(), std::back_inserter(keyConnects), [](const auto& s) {return s;});
+            auto& neighbors = interferenceGraph[f].neighbors(node); 
+            std::transform(neighbors.begin(), neighbors.end(), std::back_inserter(keyConnects), [&](uint32_t n) {return names[n];});
             std::sort(keyConnects.begin(), keyConnects.end()); 
             out << key;
             for (const auto& neigh : keyConnects) {
@@ -649,8 +1496,14 @@ namespace L2{
         }
     }
 
-    void analyze_liveness(Program& p) {
-        LivenessAnalysisBehavior b(std::cout);
+    void analyze_liveness(Program& p, bool verbose, size_t jobs, size_t linearScanAbove, CallConvention convention, bool freeCalleeSaved) {
+        if (convention == call_return) {
+            drop_return_address_stores(p); 
+        }
+        if (freeCalleeSaved) {
+            save_callee_saved_registers(p); 
+        }
+        LivenessAnalysisBehavior b(std::cout, verbose, jobs, linearScanAbove, freeCalleeSaved);
         p.accept(b); 
         return;
     }
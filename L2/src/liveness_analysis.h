@@ -1,28 +1,61 @@
 #pragma once
 
 #include <algorithm> 
+#include <cstdint> 
 #include <iterator> 
 #include <unordered_map> 
 #include <unordered_set> 
 #include <vector> 
 #include <behavior.h>
+#include <bit_vector.h>
+#include <degree_buckets.h>
+#include <interference_graph.h>
 #include <spill.h> 
+#include <spill_heap.h>
 #include <code_generator.h>
 #include <helper.h> 
 #include <L2.h>
 
 namespace L2{
 
+  // Sets are indexed by node; see nodeNames/nodeIndices 
   struct livenessSets {
-    std::unordered_set<std::string> gen; 
-    std::unordered_set<std::string> kill; 
-    std::unordered_set<std::string> in; 
-    std::unordered_set<std::string> out; 
+    BitVector gen; 
+    BitVector kill; 
+    bool call = false; 
+  };
+
+  // Instructions [first, last], last == first - 1 once spilling empties the block; 
+  // only block-boundary IN/OUT are kept, per-instruction sets are derived on demand 
+  struct basicBlock {
+    size_t first = 0; 
+    size_t last = 0; 
+    size_t loopDepth = 0; 
+    std::vector<size_t> successors; 
+    std::vector<size_t> predecessors; 
+    BitVector gen; 
+    BitVector kill; 
+    BitVector in; 
+    BitVector out; 
+  };
+
+  // dst <- src at instruction j, a coalescing candidate 
+  struct moveCandidate {
+    size_t dst; 
+    size_t src; 
+    size_t instruction; 
+  };
+
+  // Points 2j and 2j+1 sit before and after instruction j 
+  struct liveInterval {
+    size_t node; 
+    size_t start; 
+    size_t end; 
   };
 
   class LivenessAnalysisBehavior : public Behavior {
     public: 
-      explicit LivenessAnalysisBehavior(std::ostream &out);
+      explicit LivenessAnalysisBehavior(std::ostream &out, bool verbose = false, size_t jobs = 1, size_t linearScanAbove = SIZE_MAX, bool calleeSavesCopied = false);
       void act(Program& p) override; 
       void act(Function &f) override; 
       void act(Instruction_assignment &i) override; 
@@ -46,24 +79,55 @@ namespace L2{
       void print_interference_tests();
 
       void initialize_containers(size_t n); 
+      void allocate_function(Program& p, size_t i); 
+      void allocate_functions_parallel(Program& p); 
+      bool linear_scan_function(Program& p); 
+      bool linear_scan(const Program& p); 
       void clear_function_containers();
 
       bool isVariable(const Item* var);
       bool isLivenessContributor(const Item* var); 
       bool isNoSuccessorInstruction(const Instruction* i);
+      bool hasSideEffects(const Instruction* i); 
 
       void collectVar(const Item* var); 
+      size_t nodeIndex(const std::string& name); 
+      std::unordered_set<std::string> names_of(size_t f, const BitVector& bv); 
 
+      size_t label_block(const std::string& label); 
+      void build_basic_blocks(const Program &p); 
+      void block_gen_kill(basicBlock& block); 
+      void compute_loop_depths(); 
       void generate_in_out_sets(const Program &p); 
+      void function_in_out(size_t f, std::vector<BitVector>& ins, std::vector<BitVector>& outs); 
+      void instruction_in_out(size_t f, size_t b, std::vector<BitVector>& ins, std::vector<BitVector>& outs); 
+      size_t eliminate_dead_code(Program &p); 
       void generate_interference_graph(const Program &p); 
-
-      std::string pick_low_node(); 
-      std::string pick_high_node(); 
-      void update_graph(const std::string &selected); 
+      void add_instruction_edges(Instruction* i, const livenessSets& ls, const BitVector& out); 
+      void initialize_node_degrees(); 
+      void patch_after_spill(const Program &p, const spillRewrites &rewrites); 
+
+      void compute_spill_costs(); 
+      size_t pick_low_node(); 
+      size_t pick_high_node(); 
+      void update_graph(size_t selected); 
       void select_nodes(); 
 
-      bool color_or_spill_node(const std::string &cur_node, const std::unordered_set<std::string> &neighbors); 
+      size_t alias_of(size_t n); 
+      bool briggs_safe(size_t a, size_t b); 
+      bool george_safe(size_t reg, size_t var); 
+      bool coalesce_moves(InterferenceGraph& original); 
+
+      bool color_or_spill_node(size_t cur_node); 
       bool color_graph(); 
+      void record_colors(); 
+      void count_callee_saved_homes(); 
+      void spill_all_variables(); 
+      std::unordered_map<std::string, Item*> rematerializable(const Program &p); 
+      size_t stack_slot(const Item* item); 
+      void share_stack_slots(Program &p); 
+
+      static constexpr size_t noNode = SIZE_MAX; 
 
  
     private: 
@@ -71,25 +135,49 @@ namespace L2{
       size_t cur_i = 0; 
 
       std::vector<std::unordered_set<std::string>> variables; 
+      std::vector<std::vector<std::string>> nodeNames; 
+      std::vector<std::unordered_map<std::string, size_t>> nodeIndices; 
 
       std::vector<std::vector<livenessSets>> livenessData; 
+      std::vector<std::vector<basicBlock>> basicBlocks; 
+      std::vector<std::vector<size_t>> instructionBlock; 
       std::vector<std::unordered_map<std::string, size_t>> labelMap; 
-      std::vector<std::unordered_map<std::string, std::unordered_set<std::string>>> interferenceGraph; 
-
-      std::vector<std::unordered_map<std::string, size_t>> nodeDegrees; 
-      std::vector<std::unordered_set<std::string>> removed_nodes; 
-      std::vector<std::vector<std::string>> node_stack; 
+      std::vector<std::vector<moveCandidate>> moves; 
+      std::vector<std::vector<size_t>> coalescedInto; 
+      std::vector<InterferenceGraph> interferenceGraph; 
+
+      std::vector<std::vector<size_t>> nodeDegrees; 
+      std::vector<std::vector<char>> removed_nodes; 
+      std::vector<std::vector<double>> spillCosts; 
+      std::vector<std::vector<char>> retiredNodes; 
+      std::vector<DegreeBuckets> degreeBuckets; 
+      std::vector<SpillHeap> spillHeaps; 
+      std::vector<std::vector<size_t>> node_stack; 
+      std::vector<std::vector<int>> nodeColors; 
  
       std::vector<std::unordered_set<std::string>> spillOutputs; 
       std::vector<std::unordered_map<std::string, std::string>> colorOutputs; 
 
       std::vector<size_t> tempCounters;
       std::vector<size_t> spillCounters; 
+      std::vector<size_t> allocationRounds; 
+      std::vector<size_t> spilledVariables; 
+      std::vector<size_t> coalescedMoves; 
+      std::vector<char> hasReturn; 
+      std::vector<size_t> calleeSavedVariables; 
+      std::vector<size_t> spillOpsAvoided; 
+      std::vector<size_t> calleeSavedCopies; 
+      std::vector<char> linearScanned; 
+      std::vector<size_t> deadInstructions; 
 
       std::ostream &out; 
+      bool verbose; 
+      size_t jobs; 
+      size_t linearScanAbove; 
+      bool calleeSavesCopied; 
   }; 
 
 
-    void analyze_liveness(Program& p); 
+    void analyze_liveness(Program& p, bool verbose = false, size_t jobs = 1, size_t linearScanAbove = SIZE_MAX, CallConvention convention = label_return, bool freeCalleeSaved = false); 
 
 }
@@ -1,9 +1,10 @@
 #include <spill.h> 
 
 namespace L2 {
-    SpillBehavior::SpillBehavior(const std::unordered_set<std::string> &spillInputs, size_t functionIndex, size_t temps, size_t spills) 
-        : spillInputs(spillInputs), functionIndex(functionIndex), tempCounter(temps), spillCounter(spills) {
+    SpillBehavior::SpillBehavior(const std::unordered_set<std::string> &spillInputs, const std::unordered_map<std::string, Item*> &remat, size_t functionIndex, size_t temps, size_t spills) 
+        : spillInputs(spillInputs), remat(remat), functionIndex(functionIndex), tempCounter(temps), spillCounter(spills) {
             for (const auto& v : spillInputs) {
+                if (remat.count(v)) continue; // recomputed at each use, no stack slot 
                 varOffsets[v] = spillCounter * 8; 
                 spillCounter++; 
             }
@@ -15,9 +16,42 @@ namespace L2 {
     }
 
     void SpillBehavior::act(Function& f) {
-        for (const auto& i: f.instructions) {
+        for (size_t j = 0; j < f.instructions.size(); j++) {
+            Instruction* i = f.instructions[j]; 
+            size_t start = newInstructions.size(); 
+            size_t temps = tempCounter; 
+            touched = false; 
+            rewrites.starts.push_back(start); 
             i->accept(*this);
+            if (touched) {
+                rewrites.replaced.push_back(j); 
+                continue; 
+            }
+            // No spilled variable here, keep the original instruction as is 
+            for (size_t k = start; k < newInstructions.size(); k++) {
+                delete newInstructions[k]; 
+            }
+            newInstructions.resize(start); 
+            newInstructions.push_back(i); 
+            tempCounter = temps; 
+        }
+        rewrites.starts.push_back(newInstructions.size()); 
+
+        // Squeeze out the stores that were overwritten before being loaded 
+        size_t kept = 0; 
+        size_t s = 0; 
+        for (size_t k = 0; k < newInstructions.size(); k++) {
+            while (s < rewrites.starts.size() && rewrites.starts[s] == k) {
+                rewrites.starts[s++] = kept; 
+            }
+            if (newInstructions[k]) {
+                newInstructions[kept++] = newInstructions[k]; 
+            }
+        }
+        while (s < rewrites.starts.size()) {
+            rewrites.starts[s++] = kept; 
         }
+        newInstructions.resize(kept); 
         f.instructions = newInstructions;
     }
 
@@ -48,6 +82,15 @@ namespace L2 {
             newInstructions.push_back(ni); 
 
             write(dst, temp2); 
+        } else if (src->kind() == ItemType::VariableItem && remat.count(src->emit()) 
+                   && !(dst->kind() == ItemType::VariableItem && spillInputs.count(dst->emit()))) {
+            touched = true; 
+            newInstructions.push_back(new Instruction_assignment(dst, remat[src->emit()])); 
+        } else if (foldable(src) && !(dst->kind() == ItemType::VariableItem && spillInputs.count(dst->emit()))) {
+            // Load straight into the destination, no temp 
+            touched = true; 
+            newInstructions.push_back(new Instruction_assignment(dst, slot(src->emit()))); 
+            pendingStores.erase(src->emit()); 
         } else {
             Item* temp = read(src);
             write(dst, temp);
@@ -73,6 +116,30 @@ namespace L2 {
         Item* rhs = i.rhs(); 
         AOP aop = i.aop(); 
 
+        // x86 adds and subtracts with one memory operand: mem rsp off += t, w += mem rsp off 
+        if (aop == AOP::plus_equal || aop == AOP::minus_equal) {
+            if (foldable(dst) && !(rhs->kind() == ItemType::VariableItem && rhs->emit() == dst->emit())) {
+                touched = true; 
+                Item* rhsTemp = read(rhs); 
+                newInstructions.push_back(new Instruction_mem_aop(slot(dst->emit()), aop, rhsTemp)); 
+                pendingStores.erase(dst->emit()); 
+                return; 
+            }
+            if (foldable(rhs) && !(dst->kind() == ItemType::VariableItem && spillInputs.count(dst->emit()))) {
+                touched = true; 
+                newInstructions.push_back(new Instruction_mem_aop(dst, aop, slot(rhs->emit()))); 
+                pendingStores.erase(rhs->emit()); 
+                return; 
+            }
+        }
+        if (rhs->kind() == ItemType::VariableItem && remat.count(rhs->emit()) 
+            && remat[rhs->emit()]->kind() == ItemType::NumberItem 
+            && !(dst->kind() == ItemType::VariableItem && spillInputs.count(dst->emit()))) {
+            touched = true; 
+            newInstructions.push_back(new Instruction_aop(dst, aop, remat[rhs->emit()])); 
+            return; 
+        }
+
         Item* dstTemp = read(dst); 
         Item* rhsTemp = read(rhs); 
         auto ni = new Instruction_aop(dstTemp, aop, rhsTemp);
@@ -136,9 +203,11 @@ namespace L2 {
 
         auto ni = new Instruction_cjump(lhsTemp, cmp, rhsTemp, label); 
         newInstructions.push_back(ni); 
+        forget_reloads(); 
     }
 
     void SpillBehavior::act(Instruction_label &i) {
+        forget_reloads(); 
         Label* label = i.label(); 
         auto ni = new Instruction_label(label);
         newInstructions.push_back(ni); 
@@ -148,11 +217,13 @@ namespace L2 {
         Label* label = i.label(); 
         auto ni = new Instruction_goto(label);
         newInstructions.push_back(ni);  
+        forget_reloads(); 
     }
     
     void SpillBehavior::act(Instruction_ret &i) {
         auto ni = new Instruction_ret(); 
         newInstructions.push_back(ni); 
+        forget_reloads(); 
     }
 
     void SpillBehavior::act(Instruction_call &i) {
@@ -167,11 +238,19 @@ namespace L2 {
             auto ni = new Instruction_call(ct, callee, numArgs); 
             newInstructions.push_back(ni);
         }
+        forget_reloads(); 
     }
 
     void SpillBehavior::act(Instruction_reg_inc_dec &i) { 
         Item* dst = i.dst(); 
         IncDec op = i.op(); 
+        if (foldable(dst)) {
+            touched = true; 
+            AOP aop = op == IncDec::increment ? AOP::plus_equal : AOP::minus_equal; 
+            newInstructions.push_back(new Instruction_mem_aop(slot(dst->emit()), aop, new Number(1))); 
+            pendingStores.erase(dst->emit()); 
+            return; 
+        }
         auto dstTemp = read(dst); 
         auto ni = new Instruction_reg_inc_dec(dstTemp, op); 
         newInstructions.push_back(ni);
@@ -200,6 +279,7 @@ namespace L2 {
         tempCounter++; 
         std::string tempString = temp.str(); 
         Item* var = new Variable(tempString);
+        ownTemps.insert(var); 
         return var; 
     }
 
@@ -211,8 +291,23 @@ namespace L2 {
             var = new Memory(temp, m->getOffset()); 
         } else if (src->kind() == ItemType::VariableItem && spillInputs.count(src->emit())) {
             std::string v = src->emit(); 
+            touched = true; 
+
+            auto cached = reloaded.find(v); 
+            if (cached != reloaded.end()) {
+                return cached->second; 
+            }
 
             var = newTemp();
+            // Respilled temps keep one reload per use so their ranges stay short 
+            if (v.rfind("%S", 0) != 0) {
+                reloaded[v] = var; 
+            }
+
+            if (remat.count(v)) {
+                newInstructions.push_back(new Instruction_assignment(var, remat[v])); 
+                return var; 
+            }
 
             auto reg = new Register(RegisterID::rsp); 
             auto num = new Number(varOffsets[v]);
@@ -221,6 +316,7 @@ namespace L2 {
             auto i = new Instruction_assignment(var, mem);
 
             newInstructions.push_back(i);
+            pendingStores.erase(v); 
 
         } else {
             var = src; 
@@ -232,6 +328,39 @@ namespace L2 {
         Instruction* i; 
         if (dst->kind() == ItemType::VariableItem && spillInputs.count(dst->emit())) {
             std::string v = dst->emit(); 
+            touched = true; 
+
+            // toWrite now holds v, so whatever else was cached in it is stale 
+            for (auto it = reloaded.begin(); it != reloaded.end(); ) {
+                if (it->second == toWrite && it->first != v) {
+                    it = reloaded.erase(it); 
+                } else {
+                    it++; 
+                }
+            }
+
+            // The only definition of a rematerialized variable goes away 
+            if (remat.count(v)) return; 
+
+            if (v.rfind("%S", 0) != 0 && ownTemps.count(toWrite)) {
+                reloaded[v] = toWrite; 
+            } else {
+                reloaded.erase(v); 
+            }
+
+            // A store that nothing loaded since is dead. Only stores of our own temps or
+            // constants are dropped, so no variable or register outside the block loses a use 
+            auto pending = pendingStores.find(v); 
+            if (pending != pendingStores.end()) {
+                delete newInstructions[pending->second]; 
+                newInstructions[pending->second] = nullptr; 
+                pendingStores.erase(pending); 
+            }
+            bool droppable = ownTemps.count(toWrite) 
+                || (toWrite->kind() != ItemType::VariableItem && toWrite->kind() != ItemType::RegisterItem); 
+            if (v.rfind("%S", 0) != 0 && droppable) {
+                pendingStores[v] = newInstructions.size(); 
+            }
 
             auto reg = new Register(RegisterID::rsp); 
             auto num = new Number(varOffsets[v]); 
@@ -244,9 +373,29 @@ namespace L2 {
         newInstructions.push_back(i); 
     }
 
-    std::tuple<size_t, size_t> spill(Program& p, const std::unordered_set<std::string> &spillInputs, size_t functionIndex, size_t temps, size_t spills) {
-        SpillBehavior sb(spillInputs, functionIndex, temps, spills); 
+    bool SpillBehavior::foldable(const Item* i) {
+        // A spilled variable whose current value is only in its stack slot 
+        if (i->kind() != ItemType::VariableItem) return false; 
+        std::string v = i->emit(); 
+        return spillInputs.count(v) && !remat.count(v) && !reloaded.count(v); 
+    }
+
+    Memory* SpillBehavior::slot(const std::string& v) {
+        auto reg = new Register(RegisterID::rsp); 
+        auto num = new Number(varOffsets[v]); 
+        return new Memory(reg, num); 
+    }
+
+    void SpillBehavior::forget_reloads() {
+        // Block boundary or call: later uses reload from the stack 
+        reloaded.clear(); 
+        pendingStores.clear(); 
+    }
+
+    std::tuple<size_t, size_t> spill(Program& p, const std::unordered_set<std::string> &spillInputs, const std::unordered_map<std::string, Item*> &remat, size_t functionIndex, size_t temps, size_t spills, spillRewrites &rewrites) {
+        SpillBehavior sb(spillInputs, remat, functionIndex, temps, spills); 
         p.accept(sb); 
+        rewrites = std::move(sb.rewrites); 
         return {sb.tempCounter, sb.spillCounter}; 
     }
 }
\ No newline at end of file
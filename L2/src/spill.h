@@ -7,16 +7,22 @@
 #include <vector> 
 #include <sstream> 
 #include <tuple> 
-#include <liveness_analysis.h>
+#include <behavior.h>
 #include <L2.h>
 
 
 namespace L2{
 
+    // Where each original instruction landed after spilling; starts has one extra entry for the end 
+    struct spillRewrites {
+        std::vector<size_t> starts; 
+        std::vector<size_t> replaced; 
+    };
+
 
     class SpillBehavior: public Behavior {
         public: 
-            explicit SpillBehavior(const std::unordered_set<std::string> &spillInputs, size_t functionIndex, size_t temps, size_t spills); 
+            explicit SpillBehavior(const std::unordered_set<std::string> &spillInputs, const std::unordered_map<std::string, Item*> &remat, size_t functionIndex, size_t temps, size_t spills); 
             void act(Program& p) override; 
             void act(Function &f) override; 
             virtual void act(Instruction_assignment &i) override; 
@@ -36,16 +42,27 @@ namespace L2{
             Item* newTemp();
             Item* read(Item* src);
             void write(Item* dst, Item* toWrite); 
+            void forget_reloads(); 
+            bool foldable(const Item* i); 
+            Memory* slot(const std::string& v); 
 
             size_t spillCounter = 0; 
             size_t tempCounter = 0; 
+            spillRewrites rewrites; 
         private:  
             std::unordered_set<std::string> spillInputs; 
             std::unordered_map<std::string, size_t> varOffsets; 
+            std::unordered_map<std::string, Item*> remat; 
             size_t functionIndex; 
             
             std::vector<Instruction*> newInstructions;
+            bool touched = false; 
+
+            // Within a block: the temp holding each spilled variable, and its last store 
+            std::unordered_map<std::string, Item*> reloaded; 
+            std::unordered_map<std::string, size_t> pendingStores; 
+            std::unordered_set<const Item*> ownTemps; 
     };
 
-    std::tuple<size_t, size_t> spill(Program &p, const std::unordered_set<std::string> &spillInputs, size_t functionIndex, size_t temps, size_t spills); 
+    std::tuple<size_t, size_t> spill(Program &p, const std::unordered_set<std::string> &spillInputs, const std::unordered_map<std::string, Item*> &remat, size_t functionIndex, size_t temps, size_t spills, spillRewrites &rewrites); 
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include <utility>
+
+#include <spill_heap.h>
+
+namespace L2 {
+
+    void SpillHeap::reset(size_t nodes) {
+        heap.clear();
+        slot.assign(nodes, none);
+        keys.assign(nodes, 0.0);
+        degrees.assign(nodes, 0);
+    }
+
+    void SpillHeap::update(size_t node, double cost, size_t degree) {
+        keys[node] = cost / degree;
+        degrees[node] = degree;
+        if (slot[node] == none) {
+            slot[node] = heap.size();
+            heap.push_back(node);
+        }
+        sift_up(slot[node]);
+        sift_down(slot[node]);
+    }
+
+    void SpillHeap::remove(size_t node) {
+        size_t i = slot[node];
+        if (i == none) return;
+        swap_slots(i, heap.size() - 1);
+        heap.pop_back();
+        slot[node] = none;
+        if (i < heap.size()) {
+            sift_up(i);
+            sift_down(i);
+        }
+    }
+
+    bool SpillHeap::contains(size_t node) const {
+        return slot[node] != none;
+    }
+
+    size_t SpillHeap::top() const {
+        return heap.empty() ? none : heap[0];
+    }
+
+    bool SpillHeap::before(size_t a, size_t b) const {
+        if (keys[a] != keys[b]) return keys[a] < keys[b];
+        return degrees[a] > degrees[b];
+    }
+
+    void SpillHeap::swap_slots(size_t i, size_t j) {
+        std::swap(heap[i], heap[j]);
+        slot[heap[i]] = i;
+        slot[heap[j]] = j;
+    }
+
+    void SpillHeap::sift_up(size_t i) {
+        while (i > 0 && before(heap[i], heap[(i - 1) / 2])) {
+            swap_slots(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void SpillHeap::sift_down(size_t i) {
+        while (true) {
+            size_t best = i;
+            for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap.size(); child++) {
+                if (before(heap[child], heap[best])) best = child;
+            }
+            if (best == i) return;
+            swap_slots(i, best);
+            i = best;
+        }
+    }
+}
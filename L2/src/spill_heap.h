@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace L2 {
+
+    /*
+     * Indexed binary min-heap of spill candidates keyed by cost per unit of
+     * degree, ties going to the higher degree. Each node remembers its heap
+     * slot, so a degree change repositions it in O(log n) instead of the
+     * caller rescanning every candidate for each pick.
+     */
+    class SpillHeap {
+        public:
+            static constexpr size_t none = SIZE_MAX;
+
+            void reset(size_t nodes);
+
+            // Inserts the node, or moves it if it is already queued
+            void update(size_t node, double cost, size_t degree);
+            void remove(size_t node);
+            bool contains(size_t node) const;
+
+            // The cheapest node to spill, or none when the heap is empty
+            size_t top() const;
+
+        private:
+            bool before(size_t a, size_t b) const;
+            void swap_slots(size_t i, size_t j);
+            void sift_up(size_t i);
+            void sift_down(size_t i);
+
+            std::vector<size_t> heap;
+            std::vector<size_t> slot;
+            std::vector<double> keys;
+            std::vector<size_t> degrees;
+    };
+}
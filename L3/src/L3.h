@@ -26,6 +26,9 @@ namespace L3 {
 
   enum CallType {l3, print, input, allocate, tuple_error, tensor_error}; 
 
+  // label_return stores a return label at mem rsp -8 and jumps; call_return uses call/ret 
+  enum CallConvention {label_return, call_return}; 
+
 
   // Items 
 
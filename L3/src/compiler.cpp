@@ -22,6 +22,7 @@
 #include <liveness_analysis.h>
 #include <merge_trees.h>
 #include <tiler.h> 
+#include <helper.h>
 
 std::string read_file(const char *path) {
   std::ifstream in(path);
@@ -31,7 +32,7 @@ std::string read_file(const char *path) {
 }
 
 void print_help (char *progName){
-  std::cerr << "Usage: " << progName << " [-v] [-i] [-g 0|1] [-O 0|1|2] SOURCE" << std::endl;
+  std::cerr << "Usage: " << progName << " [-v] [-i] [-g 0|1] [-O 0|1|2] [-c jmp|call] SOURCE" << std::endl;
   return ;
 }
 
@@ -43,7 +44,8 @@ int main(
   auto liveness_analysis = false; 
   bool interference = false; 
   int32_t optLevel = 0;
-  bool verbose;
+  bool verbose = false;
+  L3::CallConvention convention = L3::label_return;
 
   /* 
    * Check the compiler arguments.
@@ -53,7 +55,7 @@ int main(
     return 1;
   }
   int32_t opt;
-  while ((opt = getopt(argc, argv, "vlig:O:")) != -1) {
+  while ((opt = getopt(argc, argv, "vlig:O:c:")) != -1) {
     switch (opt){
       case 'O':
         optLevel = strtoul(optarg, NULL, 0);
@@ -63,6 +65,10 @@ int main(
         enable_code_generator = (strtoul(optarg, NULL, 0) == 0) ? false : true ;
         break ;
 
+      case 'c':
+        convention = L3::convention_from_string(optarg);
+        break ;
+
       case 'v':
         verbose = true;
         break ;
@@ -90,7 +96,7 @@ int main(
   std::ofstream outputFile;
   outputFile.open("prog.L2");
 
-  tile_program(p, outputFile); 
+  tile_program(p, outputFile, convention, verbose); 
 
   return 0;
 }
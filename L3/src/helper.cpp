@@ -19,4 +19,10 @@ namespace L3 {
           s == ">=" ? CMP::greater_than_equal :
           throw std::runtime_error("bad CMP");
   }
+
+  CallConvention convention_from_string(std::string_view s) {
+    return s == "jmp" ? CallConvention::label_return :
+          s == "call" ? CallConvention::call_return :
+          throw std::runtime_error("bad calling convention");
+  }
 }
@@ -11,4 +11,5 @@
 namespace L3 {
     OP op_from_string(std::string_view s);
     CMP cmp_from_string(std::string_view s);
+    CallConvention convention_from_string(std::string_view s);
 }
@@ -13,7 +13,7 @@ static bool leaf_is_var(const Leaf &leaf, std::string &out_var) {
 
 static bool tree_defines_var(const Tree *t, std::string &out_var) {
   if (!t) return false;
-  if (t->kind != TreeType::Assign) return false;
+  if (t->kind != TreeType::Assign && t->kind != TreeType::Load) return false;
   if (!t->lhs) return false;
   if (t->lhs->kind != TreeType::Leaf || !t->lhs->leaf.has_value()) return false;
   return leaf_is_var(*t->lhs->leaf, out_var);
@@ -78,7 +78,7 @@ static void substitute_uses_of_var(std::unique_ptr<Tree> &root,
   if (!root || !replacement) return;
   Tree *t = root.get();
 
-  if (t->kind == TreeType::Assign && t->rhs) {
+  if ((t->kind == TreeType::Assign || t->kind == TreeType::Load) && t->rhs) {
     substitute_var_in_subtree(t->rhs, var_name, replacement);
   } else {
     substitute_var_in_subtree(root, var_name, replacement);
@@ -179,10 +179,16 @@ static bool try_merge_pair(std::vector<Node> &nodes,
     return false;
   }
 
-  if (t2->kind != TreeType::Assign || !t2->rhs) {
+  if (!t2->rhs) {
     return false;
   }
-  const Tree *rhs_of_T2 = t2->rhs.get();
+  // A load moves into its use as an address-only Load node; nothing
+  // runs between the two trees, so it still reads the same memory
+  std::unique_ptr<Tree> load;
+  if (t2->kind == TreeType::Load) {
+    load = make_load(nullptr, clone_tree(t2->rhs.get()));
+  }
+  const Tree *rhs_of_T2 = load ? load.get() : t2->rhs.get();
 
   substitute_uses_of_var(*t1_uptr, v, rhs_of_T2);
 
@@ -1,6 +1,8 @@
 #include "tiler.h"
 
+#include <algorithm>
 #include <cassert>
+#include <stdexcept>
 #include <type_traits>
 #include <variant>
 
@@ -53,6 +55,233 @@ namespace L3 {
     return "?cmp";
   }
 
+  static std::optional<int64_t> number_of(const Tree* t) {
+    if (t && is_leaf(*t)) {
+      if (auto* n = std::get_if<NumberLeaf>(&*t->leaf)) return n->n;
+    }
+    return std::nullopt;
+  }
+
+  static bool is_var(const Tree* t, const std::string& var) {
+    if (!t || !is_leaf(*t)) return false;
+    auto* v = std::get_if<VarLeaf>(&*t->leaf);
+    return v && v->var == var;
+  }
+
+  // Ends up in a variable: a variable leaf or a subtree computed into a temporary
+  static bool is_value(const Tree* t) {
+    return t && (!is_leaf(*t) || std::holds_alternative<VarLeaf>(*t->leaf));
+  }
+
+  static bool is_binop(const Tree* t, OP op) {
+    return t && t->kind == TreeType::BinOp && t->binOp == op;
+  }
+
+  static bool commutes(OP op) {
+    return op == plus || op == times || op == at;
+  }
+
+  static bool same_tree(const Tree* a, const Tree* b) {
+    if (!a || !b) return a == b;
+    if (a->kind != b->kind || a->binOp != b->binOp || a->cmp != b->cmp) return false;
+    if (a->leaf.has_value() != b->leaf.has_value()) return false;
+    if (a->leaf && (a->leaf->index() != b->leaf->index() || leaf_to_str(*a->leaf) != leaf_to_str(*b->leaf))) return false;
+    return same_tree(ptr(a->lhs), ptr(b->lhs)) && same_tree(ptr(a->rhs), ptr(b->rhs));
+  }
+
+  // x + M or M + x, with M a multiple of 8 as mem x M requires
+  static bool match_offset(const Tree* t, const Tree*& base, int64_t& offset) {
+    if (!is_binop(t, plus)) return false;
+    for (int k = 0; k < 2; k++) {
+      const Tree* b = ptr(k ? t->rhs : t->lhs);
+      auto n = number_of(ptr(k ? t->lhs : t->rhs));
+      if (n && *n % 8 == 0 && is_value(b)) {
+        base = b;
+        offset = *n;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void match_address(const Tree* t, const Tree*& base, int64_t& offset) {
+    if (!match_offset(t, base, offset)) {
+      base = t;
+      offset = 0;
+    }
+  }
+
+  /*
+   * The tile catalogue. Statement tiles cover Store and Break roots; the rest
+   * compute a value into the destination they are handed.
+   */
+
+  // store A <- (load A) op t  =>  mem x M op= t
+  static bool match_store_rmw(const Tree* t, const std::string&, Match& m) {
+    const Tree* v = ptr(t->rhs);
+    if (t->kind != TreeType::Store || !v || v->kind != TreeType::BinOp) return false;
+    OP op = *v->binOp;
+    if (op != plus && op != minus && op != at) return false;
+    for (int k = 0; k < (commutes(op) ? 2 : 1); k++) {
+      const Tree* load = ptr(k ? v->rhs : v->lhs);
+      if (load->kind == TreeType::Load && same_tree(ptr(load->rhs), ptr(t->lhs))) {
+        match_address(ptr(t->lhs), m.lhs, m.offset);
+        m.rhs = ptr(k ? v->lhs : v->rhs);
+        m.op = op;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool match_store_offset(const Tree* t, const std::string&, Match& m) {
+    if (t->kind != TreeType::Store || !match_offset(ptr(t->lhs), m.lhs, m.offset)) return false;
+    m.rhs = ptr(t->rhs);
+    return true;
+  }
+
+  static bool match_store(const Tree* t, const std::string&, Match& m) {
+    if (t->kind != TreeType::Store) return false;
+    m.lhs = ptr(t->lhs);
+    m.rhs = ptr(t->rhs);
+    return true;
+  }
+
+  static bool match_branch_compare(const Tree* t, const std::string&, Match& m) {
+    const Tree* cond = ptr(t->rhs);
+    if (t->kind != TreeType::Break || !cond || cond->kind != TreeType::Cmp) return false;
+    m.label = ptr(t->lhs);
+    m.lhs = ptr(cond->lhs);
+    m.rhs = ptr(cond->rhs);
+    m.cmp = cond->cmp;
+    return true;
+  }
+
+  static bool match_branch(const Tree* t, const std::string&, Match& m) {
+    if (t->kind != TreeType::Break || !t->rhs) return false;
+    m.label = ptr(t->lhs);
+    m.rhs = ptr(t->rhs);
+    return true;
+  }
+
+  static bool match_goto(const Tree* t, const std::string&, Match& m) {
+    if (t->kind != TreeType::Break || t->rhs) return false;
+    m.label = ptr(t->lhs);
+    return true;
+  }
+
+  // b + c*E or b + (c << k)  =>  d @ b c E
+  static bool match_lea_scaled(const Tree* t, const std::string&, Match& m) {
+    if (!is_binop(t, plus)) return false;
+    for (int k = 0; k < 2; k++) {
+      const Tree* b = ptr(k ? t->rhs : t->lhs);
+      const Tree* scaled = ptr(k ? t->lhs : t->rhs);
+      if (!is_value(b) || !scaled || scaled->kind != TreeType::BinOp) continue;
+      for (int j = 0; j < 2; j++) {
+        const Tree* c = ptr(j ? scaled->rhs : scaled->lhs);
+        auto n = number_of(ptr(j ? scaled->lhs : scaled->rhs));
+        if (!n || !is_value(c)) continue;
+        int64_t scale = 0;
+        if (scaled->binOp == times && (*n == 2 || *n == 4 || *n == 8)) scale = *n;
+        if (scaled->binOp == left_shift && j == 0 && *n >= 1 && *n <= 3) scale = int64_t(1) << *n;
+        if (scale == 0) continue;
+        m.lhs = b;
+        m.rhs = c;
+        m.scale = scale;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool match_lea(const Tree* t, const std::string&, Match& m) {
+    if (!is_binop(t, plus) || !is_value(ptr(t->lhs)) || !is_value(ptr(t->rhs))) return false;
+    m.lhs = ptr(t->lhs);
+    m.rhs = ptr(t->rhs);
+    return true;
+  }
+
+  // l op (load A)  =>  d <- l; d op= mem x M, unless x is d itself
+  static bool match_aop_load(const Tree* t, const std::string& dst, Match& m) {
+    if (t->kind != TreeType::BinOp || t->binOp == left_shift || t->binOp == right_shift) return false;
+    OP op = *t->binOp;
+    for (int k = 0; k < (commutes(op) ? 2 : 1); k++) {
+      const Tree* load = ptr(k ? t->lhs : t->rhs);
+      if (load->kind != TreeType::Load) continue;
+      match_address(ptr(load->rhs), m.rhs, m.offset);
+      if (is_var(m.rhs, dst)) continue;
+      m.lhs = ptr(k ? t->rhs : t->lhs);
+      m.op = op;
+      return true;
+    }
+    return false;
+  }
+
+  static bool match_load_offset(const Tree* t, const std::string&, Match& m) {
+    return t->kind == TreeType::Load && match_offset(ptr(t->rhs), m.lhs, m.offset);
+  }
+
+  static bool match_load(const Tree* t, const std::string&, Match& m) {
+    if (t->kind != TreeType::Load) return false;
+    m.lhs = ptr(t->rhs);
+    return true;
+  }
+
+  static bool match_increment(const Tree* t, const std::string& dst, Match& m) {
+    if (is_binop(t, plus)) {
+      bool left = is_var(ptr(t->lhs), dst) && number_of(ptr(t->rhs)) == 1;
+      bool right = is_var(ptr(t->rhs), dst) && number_of(ptr(t->lhs)) == 1;
+      m.op = plus;
+      return left || right;
+    }
+    m.op = minus;
+    return is_binop(t, minus) && is_var(ptr(t->lhs), dst) && number_of(ptr(t->rhs)) == 1;
+  }
+
+  // d <- d op r needs no copy
+  static bool match_in_place(const Tree* t, const std::string& dst, Match& m) {
+    if (t->kind != TreeType::BinOp) return false;
+    m.op = t->binOp;
+    if (is_var(ptr(t->lhs), dst)) {
+      m.rhs = ptr(t->rhs);
+      return true;
+    }
+    if (commutes(*t->binOp) && is_var(ptr(t->rhs), dst)) {
+      m.rhs = ptr(t->lhs);
+      return true;
+    }
+    return false;
+  }
+
+  static bool match_binop(const Tree* t, const std::string&, Match& m) {
+    if (t->kind != TreeType::BinOp) return false;
+    m.lhs = ptr(t->lhs);
+    m.rhs = ptr(t->rhs);
+    m.op = t->binOp;
+    return true;
+  }
+
+  static bool match_compare(const Tree* t, const std::string&, Match& m) {
+    if (t->kind != TreeType::Cmp) return false;
+    m.lhs = ptr(t->lhs);
+    m.rhs = ptr(t->rhs);
+    m.cmp = t->cmp;
+    return true;
+  }
+
+  static bool match_move(const Tree* t, const std::string&, Match&) {
+    return is_leaf(*t);
+  }
+
+  // L2 only has <, <= and =; the other two swap their operands
+  static std::string compare_to_str(CMP c, std::string l, std::string r) {
+    if (c == greater_than || c == greater_than_equal) {
+      std::swap(l, r);
+    }
+    const char* op = c == greater_than ? "<" : c == greater_than_equal ? "<=" : cmp_to_str(c);
+    return l + " " + op + " " + r;
+  }
+
   static std::string compute_prefix_from_program(const Program& p) {
     std::string longest = "L";
     for (auto* f : p.functions) {
@@ -106,96 +335,149 @@ namespace L3 {
 
 
 
-  TilingEngine::TilingEngine(std::ostream& out, GlobalLabel& labeler)
-    : emitter_(out), labeler_(labeler) {
+  TilingEngine::TilingEngine(std::ostream& out, GlobalLabel& labeler, CallConvention convention)
+    : emitter_(out), labeler_(labeler), convention_(convention) {
+    tiles_ = {
+      {"store-rmw",      3, 1, match_store_rmw,      &TilingEngine::emit_store_rmw},
+      {"store-offset",   3, 1, match_store_offset,   &TilingEngine::emit_store},
+      {"store",          1, 1, match_store,          &TilingEngine::emit_store},
+      {"branch-compare", 2, 1, match_branch_compare, &TilingEngine::emit_branch_compare},
+      {"branch",         1, 1, match_branch,         &TilingEngine::emit_branch},
+      {"goto",           1, 1, match_goto,           &TilingEngine::emit_goto},
+      {"lea-scaled",     3, 1, match_lea_scaled,     &TilingEngine::emit_lea},
+      {"load-offset",    3, 1, match_load_offset,    &TilingEngine::emit_load},
+      {"aop-load",       2, 2, match_aop_load,       &TilingEngine::emit_aop_load},
+      {"increment",      2, 1, match_increment,      &TilingEngine::emit_increment},
+      {"in-place",       1, 1, match_in_place,       &TilingEngine::emit_in_place},
+      {"lea",            1, 1, match_lea,            &TilingEngine::emit_lea},
+      {"load",           1, 1, match_load,           &TilingEngine::emit_load},
+      {"compare",        1, 1, match_compare,        &TilingEngine::emit_compare},
+      {"move",           1, 1, match_move,           &TilingEngine::emit_move},
+      {"binop",          1, 2, match_binop,          &TilingEngine::emit_binop},
+    };
+    std::stable_sort(tiles_.begin(), tiles_.end(), [](const Tile& a, const Tile& b) {
+      return a.size != b.size ? a.size > b.size : a.cost < b.cost;
+    });
   }
 
-std::string TilingEngine::lower_expr(const Tree* t) {
+  void TilingEngine::report(std::ostream& out) const {
+    for (const auto& tile : tiles_) {
+      out << "tile " << tile.name << " (size " << tile.size << ", cost " << tile.cost << "): " << tile.hits << " hits\n";
+    }
+  }
 
-  switch (t->kind) {
-    case TreeType::Leaf: {
-      return leaf_node_to_str(t);
+void TilingEngine::munch(const Tree* t, const std::string& dst) {
+  for (auto& tile : tiles_) {
+    Match m;
+    m.node = t;
+    if (tile.match(t, dst, m)) {
+      tile.hits++;
+      (this->*tile.emit)(m, dst);
+      return;
     }
+  }
+  throw std::runtime_error("no tile covers the tree");
+}
 
-    case TreeType::BinOp: {
-      assert(t->binOp.has_value());
-      const Tree* lhs = ptr(t->lhs);
-      const Tree* rhs = ptr(t->rhs);
-      assert(lhs && rhs);
+std::string TilingEngine::lower_expr(const Tree* t) {
+  if (is_leaf(*t)) {
+    return leaf_node_to_str(t);
+  }
+  std::string tmp = emitter_.fresh_tmp();
+  munch(t, tmp);
+  return tmp;
+}
 
-      std::string l = lower_expr(lhs);
-      std::string r = lower_expr(rhs);
+// mem x M wants a variable for x
+std::string TilingEngine::lower_address(const Tree* t) {
+  std::string addr = lower_expr(t);
+  if (is_value(t)) {
+    return addr;
+  }
+  std::string tmp = emitter_.fresh_tmp();
+  emitter_.line(tmp + " <- " + addr);
+  return tmp;
+}
 
-      std::string tmp = emitter_.fresh_tmp();
-      emitter_.line(tmp + " <- " + l);
-      emitter_.line(tmp + " " + op_to_str(*t->binOp) + " " + r);
-      return tmp;
-    }
+void TilingEngine::emit_store_rmw(const Match& m, const std::string&) {
+  std::string base = lower_address(m.lhs);
+  std::string val = lower_expr(m.rhs);
+  emitter_.line("mem " + base + " " + std::to_string(m.offset) + " " + op_to_str(*m.op) + " " + val);
+}
 
-    case TreeType::Cmp: {
-      assert(t->cmp.has_value());
-      const Tree* lhs = ptr(t->lhs);
-      const Tree* rhs = ptr(t->rhs);
-      assert(lhs && rhs);
-
-      std::string l = lower_expr(lhs);
-      std::string r = lower_expr(rhs);
-
-      std::string tmp = emitter_.fresh_tmp();
-      CMP c = *t->cmp;
-
-      std::string L = l;
-      std::string R = r;
-      const char* op_str = nullptr;
-
-      switch (c) {
-        case less_than:
-        case less_than_equal:
-        case equal:
-          op_str = cmp_to_str(c);  
-          break;
-
-        case greater_than:
-          op_str = "<";       
-          std::swap(L, R);
-          break;
-
-        case greater_than_equal:
-          op_str = "<=";           
-          std::swap(L, R);
-          break;
-      }
+void TilingEngine::emit_store(const Match& m, const std::string&) {
+  std::string base = lower_address(m.lhs);
+  std::string val = lower_expr(m.rhs);
+  emitter_.line("mem " + base + " " + std::to_string(m.offset) + " <- " + val);
+}
 
-      emitter_.line(tmp + " <- " + L + " " + op_str + " " + R);
-      return tmp;
-    }
+void TilingEngine::emit_branch_compare(const Match& m, const std::string&) {
+  std::string l = lower_expr(m.lhs);
+  std::string r = lower_expr(m.rhs);
+  emitter_.line("cjump " + compare_to_str(*m.cmp, l, r) + " " + labeler_.make_label(leaf_node_to_str(m.label)));
+}
 
-    case TreeType::Load: {
-      const Tree* dst = ptr(t->lhs);
-      const Tree* src = ptr(t->rhs);
-      assert(src && "Load must have address (rhs)");
+void TilingEngine::emit_branch(const Match& m, const std::string&) {
+  std::string cond = lower_expr(m.rhs);
+  emitter_.line("cjump " + cond + " = 1 " + labeler_.make_label(leaf_node_to_str(m.label)));
+}
 
-      std::string addr = lower_expr(src);
+void TilingEngine::emit_goto(const Match& m, const std::string&) {
+  emitter_.line("goto " + labeler_.make_label(leaf_node_to_str(m.label)));
+}
 
-      std::string tmp;
-      if (dst && is_leaf(*dst)) {
-        tmp = leaf_node_to_str(dst);
-      } else {
-        tmp = emitter_.fresh_tmp();
-      }
+void TilingEngine::emit_lea(const Match& m, const std::string& dst) {
+  std::string base = lower_expr(m.lhs);
+  std::string index = lower_expr(m.rhs);
+  emitter_.line(dst + " @ " + base + " " + index + " " + std::to_string(m.scale));
+}
 
-      emitter_.line(tmp + " <- mem " + addr + " 0");
-      return tmp;
-    }
+// The address is read after dst is written, which match_aop_load allowed for
+void TilingEngine::emit_aop_load(const Match& m, const std::string& dst) {
+  std::string base = lower_address(m.rhs);
+  munch(m.lhs, dst);
+  emitter_.line(dst + " " + op_to_str(*m.op) + " mem " + base + " " + std::to_string(m.offset));
+}
 
-    case TreeType::Assign:
-    case TreeType::Store:
-    case TreeType::Return:
-    case TreeType::Break:
-      return "";
+void TilingEngine::emit_load(const Match& m, const std::string& dst) {
+  std::string base = lower_address(m.lhs);
+  emitter_.line(dst + " <- mem " + base + " " + std::to_string(m.offset));
+}
+
+void TilingEngine::emit_increment(const Match& m, const std::string& dst) {
+  emitter_.line(dst + (m.op == plus ? " ++" : " --"));
+}
+
+void TilingEngine::emit_in_place(const Match& m, const std::string& dst) {
+  std::string val = lower_expr(m.rhs);
+  emitter_.line(dst + " " + op_to_str(*m.op) + " " + val);
+}
+
+/*
+ * dst <- l; dst op= r. r is lowered first so computing l into dst cannot
+ * clobber it; only r being dst itself still needs a copy.
+ */
+void TilingEngine::emit_binop(const Match& m, const std::string& dst) {
+  std::string r = lower_expr(m.rhs);
+  if (r == dst) {
+    r = emitter_.fresh_tmp();
+    emitter_.line(r + " <- " + dst);
   }
+  munch(m.lhs, dst);
+  emitter_.line(dst + " " + op_to_str(*m.op) + " " + r);
+}
 
-  return "";
+void TilingEngine::emit_compare(const Match& m, const std::string& dst) {
+  std::string l = lower_expr(m.lhs);
+  std::string r = lower_expr(m.rhs);
+  emitter_.line(dst + " <- " + compare_to_str(*m.cmp, l, r));
+}
+
+void TilingEngine::emit_move(const Match& m, const std::string& dst) {
+  std::string val = leaf_node_to_str(m.node);
+  if (val != dst) {
+    emitter_.line(dst + " <- " + val);
+  }
 }
 
 
@@ -207,60 +489,32 @@ void TilingEngine::tile_tree(const Tree& t) {
       const Tree* rhsNode = ptr(t.rhs);
       assert(dstNode && rhsNode);
       assert(is_leaf(*dstNode) && "Assign lhs should be a leaf variable");
-
-      std::string dst = leaf_node_to_str(dstNode);
-      std::string val = lower_expr(rhsNode);
-      emitter_.line(dst + " <- " + val);
+      munch(rhsNode, leaf_node_to_str(dstNode));
       break;
     }
 
     case TreeType::Load: {
       const Tree* dstNode = ptr(t.lhs);
-      const Tree* srcNode = ptr(t.rhs);
-      assert(dstNode && srcNode);
+      assert(dstNode && t.rhs);
       assert(is_leaf(*dstNode) && "Load lhs should be a leaf variable");
-
-      std::string dst  = leaf_node_to_str(dstNode);
-      std::string addr = lower_expr(srcNode);
-      emitter_.line(dst + " <- mem " + addr + " 0");
+      munch(&t, leaf_node_to_str(dstNode));
       break;
     }
 
-    case TreeType::Store: {
-      const Tree* addrNode = ptr(t.lhs);
-      const Tree* valNode  = ptr(t.rhs);
-      assert(addrNode && valNode);
-
-      std::string addr = lower_expr(addrNode);
-      std::string val  = lower_expr(valNode);
-      emitter_.line("mem " + addr + " 0 <- " + val);
+    case TreeType::Store:
+    case TreeType::Break: {
+      munch(&t, "");
       break;
     }
 
     case TreeType::Return: {
       if (t.lhs) {
-        std::string val = lower_expr(ptr(t.lhs));
-        emitter_.line("rax <- " + val);
+        munch(ptr(t.lhs), "rax");
       }
       emitter_.line("return");
       break;
     }
 
-    case TreeType::Break: {
-      const Tree* labelNode = ptr(t.lhs);
-      assert(labelNode && is_leaf(*labelNode));
-      std::string labelName   = leaf_node_to_str(labelNode);
-      std::string globalLabel = labeler_.make_label(labelName);
-
-      if (t.rhs) {
-        std::string cond = lower_expr(ptr(t.rhs));
-        emitter_.line("cjump " + cond + " = 1 " + globalLabel);
-      } else {
-        emitter_.line("goto " + globalLabel);
-      }
-      break;
-    }
-
     case TreeType::Leaf:
     case TreeType::BinOp:
     case TreeType::Cmp: {
@@ -297,7 +551,11 @@ void TilingEngine::tile_tree(const Tree& t) {
     }
 
     CallType c = call->c_;
-    if (c == CallType::l3) {
+    if (c == CallType::l3 && convention_ == CallConvention::call_return) {
+      // The call instruction pushes the return address itself
+      emitter_.line("call " + call->callee_->emit() + " " +
+                    std::to_string(call->args_.size()));
+    } else if (c == CallType::l3) {
 
       std::string ret = labeler_.make_fresh_label();
       emitter_.line("mem rsp -8 <- " + ret);
@@ -330,15 +588,42 @@ void TilingEngine::tile_tree(const Tree& t) {
     }
   }
 
+  // A call whose result, if any, is returned straight away
+  static bool is_tail_call(const Node& item, const Node& next) {
+    auto *t = std::get_if<std::unique_ptr<Tree>>(&next);
+    if (t == nullptr || (*t)->kind != TreeType::Return) return false;
+    const Tree* val = ptr((*t)->lhs);
+    if (auto *i = std::get_if<Instruction_call*>(&item)) {
+      return (*i)->c_ == CallType::l3 && val == nullptr;
+    }
+    if (auto *i = std::get_if<Instruction_call_assignment*>(&item)) {
+      return (*i)->c_ == CallType::l3 && val != nullptr && is_leaf(*val)
+          && leaf_node_to_str(val) == (*i)->dst_->emit();
+    }
+    return false;
+  }
+
   void TilingEngine::tile_function(Function& f) {
     labeler_.enter_function(f.name);
     emitter_.line("(" + f.name);
     initialize_function_args(f.var_arguments);
+    std::vector<const Node*> nodes;
     for (const auto& ctx : f.contexts) {
       for (auto& nodePtr : ctx.nodes) {
-        codegen(nodePtr);
+        nodes.push_back(&nodePtr);
       }
     }
+    for (size_t k = 0; k < nodes.size(); k++) {
+      // Keep call and return adjacent so L1 can turn the pair into a jump
+      if (k + 1 < nodes.size() && is_tail_call(*nodes[k], *nodes[k + 1])) {
+        if (auto *i = std::get_if<Instruction_call*>(nodes[k])) handle_call(*i);
+        if (auto *i = std::get_if<Instruction_call_assignment*>(nodes[k])) handle_call(*i);
+        emitter_.line("return");
+        k++;
+        continue;
+      }
+      codegen(*nodes[k]);
+    }
     emitter_.line(")");
   }
 
@@ -350,10 +635,13 @@ void TilingEngine::tile_tree(const Tree& t) {
     emitter_.line(")");
   }
 
-  void tile_program(Program& p, std::ostream& out) {
+  void tile_program(Program& p, std::ostream& out, CallConvention convention, bool verbose) {
     GlobalLabel labeler{}; 
     labeler.prefix = compute_prefix_from_program(p);
-    TilingEngine eng(out, labeler);
+    TilingEngine eng(out, labeler, convention);
     eng.tile(p);
+    if (verbose) {
+      eng.report(std::cerr);
+    }
   }
 } 
@@ -30,9 +30,30 @@ namespace L3 {
     const Tree* dst = nullptr;
     const Tree* lhs = nullptr;
     const Tree* rhs = nullptr;
+    const Tree* label = nullptr;
 
     std::optional<OP>  op;
     std::optional<CMP> cmp;
+
+    int64_t offset = 0;
+    int64_t scale = 1;
+  };
+
+  class TilingEngine;
+
+  /*
+   * One entry of the tile catalogue. size is the number of tree nodes the tile
+   * covers and cost the number of L2 instructions it emits, operands aside.
+   * match fills in the subtrees left for other tiles; emit writes the result
+   * into dst, which is empty for the statement tiles.
+   */
+  struct Tile {
+    std::string name;
+    int size;
+    int cost;
+    bool (*match)(const Tree* t, const std::string& dst, Match& m);
+    void (TilingEngine::*emit)(const Match& m, const std::string& dst);
+    size_t hits = 0;
   };
 
   struct GlobalLabel {
@@ -50,8 +71,9 @@ namespace L3 {
 
   class TilingEngine {
   public:
-    explicit TilingEngine(std::ostream& out, GlobalLabel& labeler);
+    TilingEngine(std::ostream& out, GlobalLabel& labeler, CallConvention convention);
     void tile(Program& p);
+    void report(std::ostream& out) const;
 
   private:
 
@@ -65,12 +87,33 @@ namespace L3 {
     void tile_tree(const Tree& t);
 
 
+    // Maximal munch: the largest (then cheapest) tile that matches at t wins
+    void munch(const Tree* t, const std::string& dst);
+
+    // The value of t as an L2 operand: the leaf itself, or a temporary holding it
     std::string lower_expr(const Tree* t);
+    std::string lower_address(const Tree* t);
+
+    void emit_store_rmw(const Match& m, const std::string& dst);
+    void emit_store(const Match& m, const std::string& dst);
+    void emit_branch_compare(const Match& m, const std::string& dst);
+    void emit_branch(const Match& m, const std::string& dst);
+    void emit_goto(const Match& m, const std::string& dst);
+    void emit_lea(const Match& m, const std::string& dst);
+    void emit_aop_load(const Match& m, const std::string& dst);
+    void emit_load(const Match& m, const std::string& dst);
+    void emit_increment(const Match& m, const std::string& dst);
+    void emit_in_place(const Match& m, const std::string& dst);
+    void emit_binop(const Match& m, const std::string& dst);
+    void emit_compare(const Match& m, const std::string& dst);
+    void emit_move(const Match& m, const std::string& dst);
 
     Emitter emitter_;
     GlobalLabel labeler_; 
+    CallConvention convention_;
+    std::vector<Tile> tiles_;
   };
 
-  void tile_program(Program& p, std::ostream& out);
+  void tile_program(Program& p, std::ostream& out, CallConvention convention = label_return, bool verbose = false);
 
 } 